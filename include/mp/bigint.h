@@ -78,9 +78,43 @@ enum mp_errc mp_bigint_mul_int(
 enum mp_errc mp_bigint_mul_uint(
     const struct mp_bigint *a, mp_uint b, struct mp_bigint *r);
 
+enum mp_errc mp_bigint_sqr(const struct mp_bigint *a, struct mp_bigint *r);
+
+// r += a b and r -= a b, without a temporary for the product unless b is
+// large
+
+enum mp_errc mp_bigint_addmul(
+    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *r);
+
+enum mp_errc mp_bigint_addmul_uint(
+    const struct mp_bigint *a, mp_uint b, struct mp_bigint *r);
+
+enum mp_errc mp_bigint_submul(
+    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *r);
+
+enum mp_errc mp_bigint_submul_uint(
+    const struct mp_bigint *a, mp_uint b, struct mp_bigint *r);
+
 enum mp_errc mp_bigint_div(const struct mp_bigint *a, const struct mp_bigint *b,
                            struct mp_bigint *q, struct mp_bigint *r);
 
+// q = a / b and r = a - q b in one division, with q rounded toward zero,
+// toward negative infinity or toward positive infinity. So r takes the sign
+// of a, the sign of b or the opposite sign of b. Either of q and r may be
+// NULL.
+
+enum mp_errc mp_bigint_tdiv(const struct mp_bigint *a,
+                            const struct mp_bigint *b, struct mp_bigint *q,
+                            struct mp_bigint *r);
+
+enum mp_errc mp_bigint_fdiv(const struct mp_bigint *a,
+                            const struct mp_bigint *b, struct mp_bigint *q,
+                            struct mp_bigint *r);
+
+enum mp_errc mp_bigint_cdiv(const struct mp_bigint *a,
+                            const struct mp_bigint *b, struct mp_bigint *q,
+                            struct mp_bigint *r);
+
 enum mp_errc mp_bigint_div_int(
     const struct mp_bigint *a, mp_int b, struct mp_bigint *q, mp_uint *r);
 
@@ -96,6 +130,29 @@ enum mp_errc mp_bigint_mod_int(
 enum mp_errc mp_bigint_mod_uint(
     const struct mp_bigint *a, mp_uint b, struct mp_bigint *r);
 
+// Prepares |b| for repeated division with mp_bigint_div_pre and
+// mp_bigint_mod_pre. Release it with mp_divisor_destruct.
+
+enum mp_errc mp_bigint_divisor_construct(
+    struct mp_divisor *div, const struct mp_bigint *b);
+
+enum mp_errc mp_bigint_div_pre(const struct mp_bigint *a,
+                               const struct mp_divisor *div,
+                               struct mp_bigint *q, struct mp_bigint *r);
+
+enum mp_errc mp_bigint_mod_pre(const struct mp_bigint *a,
+                               const struct mp_divisor *div,
+                               struct mp_bigint *r);
+
+// q = a / b, for b dividing a
+
+enum mp_errc mp_bigint_divexact(
+    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *q);
+
+mp_bool mp_bigint_divisible_uint(const struct mp_bigint *a, mp_uint b);
+
+mp_bool mp_bigint_divisible_2exp(const struct mp_bigint *a, mp_size k);
+
 enum mp_errc mp_bigint_bit_not(const struct mp_bigint *a, struct mp_bigint *r);
 
 enum mp_errc mp_bigint_bit_and(
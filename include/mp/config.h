@@ -79,6 +79,17 @@
 #define MP_ARCH_ALPHA 1
 #endif
 
+#if !defined(MP_ASM_X86_64) && MP_ARCH_X86_64 && MP_INLINE_ASM && \
+    (MP_GCC || MP_CLANG)
+#define MP_ASM_X86_64 1
+#endif
+
+// The AVX2 and AVX-512 kernels are bound from the features found by cpuid,
+// which needs the inline assembly
+#if !defined(MP_SIMD_X86_64) && MP_ASM_X86_64
+#define MP_SIMD_X86_64 1
+#endif
+
 #if MP_ARCH_X86_64
 #define MP_INT_TYPE int64_t
 #define MP_INT_WIDTH 64
@@ -123,4 +134,80 @@
 #define MP_EXPECTS(x) assert((x))
 #define MP_ENSURES(x) assert((x))
 
+#if !defined(MP_MUL_KARATSUBA_THRESHOLD)
+#define MP_MUL_KARATSUBA_THRESHOLD 32
+#endif
+
+#if !defined(MP_MUL_TOOM3_THRESHOLD)
+#define MP_MUL_TOOM3_THRESHOLD 96
+#endif
+
+#if !defined(MP_SQR_KARATSUBA_THRESHOLD)
+#define MP_SQR_KARATSUBA_THRESHOLD 48
+#endif
+
+#if !defined(MP_SQR_TOOM3_THRESHOLD)
+#define MP_SQR_TOOM3_THRESHOLD 160
+#endif
+
+#if !defined(MP_MUL_PREPARED_THRESHOLD)
+#define MP_MUL_PREPARED_THRESHOLD 1536
+#endif
+
+#if !defined(MP_MULLO_THRESHOLD)
+#define MP_MULLO_THRESHOLD 64
+#endif
+
+#if !defined(MP_MULHI_THRESHOLD)
+#define MP_MULHI_THRESHOLD 64
+#endif
+
+#if !defined(MP_MULMID_THRESHOLD)
+#define MP_MULMID_THRESHOLD 32
+#endif
+
+#if !defined(MP_MULMID_NTT_THRESHOLD)
+#define MP_MULMID_NTT_THRESHOLD 1024
+#endif
+
+#if !defined(MP_DIV_DC_THRESHOLD)
+#define MP_DIV_DC_THRESHOLD 64
+#endif
+
+#if !defined(MP_DIVEXACT_DC_THRESHOLD)
+#define MP_DIVEXACT_DC_THRESHOLD 128
+#endif
+
+#if !defined(MP_DIV_NEWTON_THRESHOLD)
+#define MP_DIV_NEWTON_THRESHOLD 8192
+#endif
+
+#if !defined(MP_DIVISOR_INVERT_THRESHOLD)
+#define MP_DIVISOR_INVERT_THRESHOLD 2048
+#endif
+
+#if !defined(MP_INVERT_THRESHOLD)
+#define MP_INVERT_THRESHOLD 64
+#endif
+
+#if !defined(MP_MOD_UINT_MULTI_BLOCK)
+#define MP_MOD_UINT_MULTI_BLOCK 256
+#endif
+
+#if !defined(MP_TO_STRING_DC_THRESHOLD)
+#define MP_TO_STRING_DC_THRESHOLD 24
+#endif
+
+#if !defined(MP_FROM_STRING_DC_THRESHOLD)
+#define MP_FROM_STRING_DC_THRESHOLD 128
+#endif
+
+#if !defined(MP_MUL_FFT_THRESHOLD)
+#define MP_MUL_FFT_THRESHOLD 4096
+#endif
+
+#if !defined(MP_MUL_NTT_THRESHOLD)
+#define MP_MUL_NTT_THRESHOLD 4096
+#endif
+
 #endif
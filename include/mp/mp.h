@@ -24,6 +24,57 @@ enum mp_endian {
     MP_ENDIAN_BIG = __ORDER_BIG_ENDIAN__
 };
 
+// Algorithm used by mp_mul for operands above the FFT thresholds
+
+enum mp_mul_backend {
+    MP_MUL_BACKEND_SSA,
+    MP_MUL_BACKEND_NTT,
+};
+
+// CPU features the kernels can be bound to. The environment variable
+// MP_CPU_FEATURES, read at load time, takes a comma separated list of these
+// names. A list that starts with a name gives the features to use, and one
+// that starts with "-name" removes features from the detected set. "none"
+// clears the set. Features the CPU lacks are never used.
+
+enum mp_cpu_feature {
+    MP_CPU_FEATURE_X86_64 = 1 << 0,
+    MP_CPU_FEATURE_BMI2 = 1 << 1,
+    MP_CPU_FEATURE_ADX = 1 << 2,
+    MP_CPU_FEATURE_AVX2 = 1 << 3,
+    MP_CPU_FEATURE_AVX512 = 1 << 4,
+};
+
+struct mp_allocator;
+
+// An operand prepared for repeated multiplication. Above
+// MP_MUL_PREPARED_THRESHOLD limbs it keeps the NTT of the operand, which
+// saves a third of the work of every product by it. The operand is not
+// copied and must outlive the handle.
+
+struct mp_mul_prepared {
+    const mp_uint *_bp;
+    mp_size _bn;
+    mp_uint *_data;
+    mp_size _size;
+    struct mp_allocator *_alloc;
+};
+
+// A divisor prepared for repeated division: normalized, with its shift and
+// the inverse of its top limbs. From MP_DIVISOR_INVERT_THRESHOLD limbs it
+// also keeps the full Newton inverse, so every block of quotient limbs costs
+// two multiplications.
+
+struct mp_divisor {
+    mp_uint *_data;
+    mp_uint *_inverse;
+    mp_size _size;
+    mp_size _capacity;
+    mp_size _shift;
+    mp_uint _inv;
+    struct mp_allocator *_alloc;
+};
+
 struct mp_to_string_result {
     enum mp_errc ec;
     char *ptr;
@@ -51,18 +102,108 @@ mp_uint mp_sub(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
 
 mp_uint mp_mul_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp);
 
+// r += a b and r -= a b over the low an limbs of r, returning the carry or
+// borrow out of them
+
+mp_uint mp_addmul_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp);
+
+mp_uint mp_submul_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp);
+
 mp_uint mp_mul(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
                mp_uint *rp);
 
+mp_uint mp_sqr(const mp_uint *ap, mp_size an, mp_uint *rp);
+
+enum mp_errc mp_mul_prepare(struct mp_mul_prepared *prep, const mp_uint *bp,
+                            mp_size bn, struct mp_allocator *alloc);
+
+void mp_mul_prepared_destruct(struct mp_mul_prepared *prep);
+
+mp_uint mp_mul_prepared(const mp_uint *ap, mp_size an,
+                        const struct mp_mul_prepared *prep, mp_uint *rp);
+
+// r = a b mod B^n
+
+void mp_mullo_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp);
+
+// r = floor(a b / B^n) - e, 0 <= e <= 3n
+
+void mp_mulhi_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp);
+
+// r = sum of a_i b_j B^(i + j - bn + 1) over bn - 1 <= i + j < an, which
+// takes an - bn + 3 limbs
+
+void mp_mulmid(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
+               mp_uint *rp);
+
+enum mp_mul_backend mp_get_mul_backend(void);
+
+enum mp_mul_backend mp_set_mul_backend(enum mp_mul_backend backend);
+
+// Features supported by both the CPU and this build
+
+unsigned mp_get_cpu_features(void);
+
+// Features the kernels are currently bound to
+
+unsigned mp_get_kernel_features(void);
+
+// Rebinds the kernels to the given features, masked by mp_get_cpu_features,
+// and returns the previous set
+
+unsigned mp_set_kernel_features(unsigned features);
+
 mp_uint mp_div_uint(const mp_uint *np, mp_size nn, mp_uint d, mp_uint *qp);
 
-void mp_div(const mp_uint *np, mp_uint nn, const mp_uint *dp, mp_size dn,
-            mp_uint *qp, mp_uint *rp);
+// q = floor(n / d), nn - dn + 1 limbs, and r = n mod d, dn limbs. Requires
+// nn >= dn and a nonzero top limb of d.
+
+enum mp_errc mp_div(const mp_uint *np, mp_size nn, const mp_uint *dp,
+                    mp_size dn, mp_uint *qp, mp_uint *rp);
+
+mp_uint mp_mod_uint(const mp_uint *np, mp_size nn, mp_uint d);
+
+// residues[j] = a mod moduli[j] for j < k, reading a once
+
+void mp_mod_uint_multi(const mp_uint *ap, mp_size an, const mp_uint *moduli,
+                       mp_size k, mp_uint *residues);
+
+enum mp_errc mp_divisor_construct(struct mp_divisor *div, const mp_uint *dp,
+                                  mp_size dn, struct mp_allocator *alloc);
+
+void mp_divisor_destruct(struct mp_divisor *div);
+
+enum mp_errc mp_div_pre(const mp_uint *np, mp_size nn,
+                        const struct mp_divisor *div, mp_uint *qp,
+                        mp_uint *rp);
+
+enum mp_errc mp_mod_pre(const mp_uint *np, mp_size nn,
+                        const struct mp_divisor *div, mp_uint *rp);
+
+// r = floor((B^2n - 1) / a) - B^n, n limbs, for a with its top bit set
+
+enum mp_errc mp_invert(const mp_uint *ap, mp_size an, mp_uint *rp);
+
+enum mp_errc mp_mod(const mp_uint *np, mp_size nn, const mp_uint *dp,
+                    mp_size dn, mp_uint *rp);
 
-void mp_mod_uint(const mp_uint *np, mp_uint nn, mp_uint d, mp_uint *rp);
+// q = n / d, nn limbs, for d dividing n
 
-void mp_mod(const mp_uint *np, mp_uint nn, const mp_uint *dp, mp_size dn,
-            mp_uint *rp);
+void mp_divexact_uint(const mp_uint *np, mp_size nn, mp_uint d, mp_uint *qp);
+
+// q = n / d, nn - dn + 1 limbs, for d dividing n. Requires nn >= dn and a
+// nonzero top limb of d.
+
+enum mp_errc mp_divexact(const mp_uint *np, mp_size nn, const mp_uint *dp,
+                         mp_size dn, mp_uint *qp);
+
+// Whether d divides n
+
+mp_bool mp_divisible_uint(const mp_uint *np, mp_size nn, mp_uint d);
+
+// Whether 2^k divides n
+
+mp_bool mp_divisible_2exp(const mp_uint *np, mp_size nn, mp_size k);
 
 mp_uint mp_left_shift(const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp);
 
@@ -114,14 +255,37 @@ mp_size mp_bit_width(const mp_uint *ap, mp_size an);
 
 mp_size mp_popcount(const mp_uint *ap, mp_size an);
 
+// popcount(a ^ b), without forming a ^ b
+
+mp_size mp_hamming_distance(
+    const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn);
+
+// Writes a in as few bytes as it takes, none for zero, and returns their
+// count, which is at most an sizeof(mp_uint)
+
 mp_size mp_to_bytes(const mp_uint *ap, mp_size an, mp_byte *bytes,
                     enum mp_endian endian);
-mp_size mp_from_bytes(
-    mp_byte *bytes, mp_size byte_count, mp_uint *rp, enum mp_endian endian);
+
+// Writes a in exactly byte_count bytes, padded with zeros, or fails with
+// MP_ERRC_VALUE_TOO_LARGE
+
+enum mp_errc mp_to_bytes_padded(const mp_uint *ap, mp_size an, mp_byte *bytes,
+                                mp_size byte_count, enum mp_endian endian);
+
+// Reads byte_count bytes into r, which takes byte_count / sizeof(mp_uint)
+// limbs rounded up, and returns the size of the value
+
+mp_size mp_from_bytes(const mp_byte *bytes, mp_size byte_count, mp_uint *rp,
+                      enum mp_endian endian);
 
 struct mp_to_string_result mp_to_string(
     char *first, char *last, const mp_uint *ap, mp_size an, int base);
 
+// Parses the digits at the start of [first, last) into a, which has room for
+// an limbs. ptr is the first character that is not a digit and size the
+// limbs of the value, or, with MP_ERRC_VALUE_TOO_LARGE, the limbs it needs.
+// Without any digits, this is MP_ERRC_INVALID_ARGUMENT.
+
 struct mp_from_string_result mp_from_string(
     const char *first, const char *last, mp_uint *ap, mp_size an, int base);
 
@@ -12,7 +12,7 @@ static inline mp_size mp_bigint_get_size(const struct mp_bigint *bigint)
 
 static inline mp_size mp_bigint_normal_size(struct mp_bigint *bigint, mp_size n)
 {
-    while (n > 0 && bigint->_data[n - 1]) {
+    while (n > 0 && !bigint->_data[n - 1]) {
         --n;
     }
 
@@ -144,6 +144,7 @@ enum mp_errc mp_bigint_construct_copy(
 
     bigint->_alloc = alloc ? alloc : other->_alloc;
     bigint->_size = other->_size;
+    bigint->_capacity = size;
     bigint->_data = mp_allocate_uint(bigint->_alloc, size);
 
     if (!bigint->_data) {
@@ -486,13 +487,16 @@ static enum mp_errc mp_bigint_mul_ord(
     MP_EXPECTS(bn);
 
     mp_size rn = an + bn;
+    mp_bool positive = mp_same_sign(a->_size, b->_size);
 
     if (bn == 1) {
+        mp_uint b0 = b->_data[0];
+
         if (mp_bigint_reserve(r, rn)) {
             return MP_ERRC_NOT_ENOUGH_MEMORY;
         }
 
-        a->_data[an] = mp_mul_uint(a->_data, an, b->_data[0], r->_data);
+        r->_data[an] = mp_mul_uint(a->_data, an, b0, r->_data);
     } else {
         struct mp_bigint tmp;
 
@@ -500,13 +504,13 @@ static enum mp_errc mp_bigint_mul_ord(
             return MP_ERRC_NOT_ENOUGH_MEMORY;
         }
 
-        mp_mul(a->_data, an, b->_data, bn, r->_data);
+        mp_mul_with_alloc(a->_data, an, b->_data, bn, tmp._data, r->_alloc);
         mp_bigint_swap(r, &tmp);
         mp_bigint_destruct(&tmp);
     }
 
     rn = mp_bigint_normal_size(r, rn);
-    r->_size = mp_same_sign(a->_size, b->_size) ? rn : -rn;
+    r->_size = positive ? rn : -rn;
 
     return MP_ERRC_OK;
 }
@@ -514,6 +518,10 @@ static enum mp_errc mp_bigint_mul_ord(
 enum mp_errc mp_bigint_mul(
     const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *r)
 {
+    if (a == b) {
+        return mp_bigint_sqr(a, r);
+    }
+
     if (!a->_size || !b->_size) {
         mp_bigint_assign_zero(r);
         return MP_ERRC_OK;
@@ -529,6 +537,29 @@ enum mp_errc mp_bigint_mul(
     }
 }
 
+enum mp_errc mp_bigint_sqr(const struct mp_bigint *a, struct mp_bigint *r)
+{
+    if (!a->_size) {
+        mp_bigint_assign_zero(r);
+        return MP_ERRC_OK;
+    }
+
+    mp_size an = mp_bigint_get_size(a);
+    mp_size rn = 2 * an;
+    struct mp_bigint tmp;
+
+    if (mp_bigint_construct_with_reserved(&tmp, rn, r->_alloc)) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_sqr_with_alloc(a->_data, an, tmp._data, r->_alloc);
+    mp_bigint_swap(r, &tmp);
+    mp_bigint_destruct(&tmp);
+
+    r->_size = mp_bigint_normal_size(r, rn);
+    return MP_ERRC_OK;
+}
+
 enum mp_errc mp_bigint_mul_int(
     const struct mp_bigint *a, mp_int b, struct mp_bigint *r)
 {
@@ -564,8 +595,271 @@ enum mp_errc mp_bigint_mul_uint(
     return MP_ERRC_OK;
 }
 
+// r += a b, negated when negative is set. The product is summed into r a row
+// of b at a time, or through a scratch product when b is large enough for the
+// subquadratic multiplications or when a or b is r. A borrow out of the top
+// means the result changed sign, and it is negated back.
+
+static enum mp_errc mp_bigint_addmul_ord(const mp_uint *ap, mp_size an,
+                                         const mp_uint *bp, mp_size bn,
+                                         mp_bool negative, struct mp_bigint *r)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
+
+    mp_size rn = mp_bigint_get_size(r);
+    mp_size pn = an + bn;
+    mp_size n = (rn > pn ? rn : pn) + 1;
+    mp_uint *tp = NULL;
+
+    if (bn >= MP_MUL_KARATSUBA_THRESHOLD || ap == r->_data ||
+        bp == r->_data) {
+        tp = mp_allocate_uint(r->_alloc, pn);
+
+        if (!tp) {
+            return MP_ERRC_NOT_ENOUGH_MEMORY;
+        }
+
+        mp_mul_with_alloc(ap, an, bp, bn, tp, r->_alloc);
+    }
+
+    if (mp_bigint_reserve(r, n)) {
+        mp_deallocate_uint(r->_alloc, tp, pn);
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_uint *rp = r->_data;
+    mp_bool sign = rn ? r->_size < 0 : negative;
+    mp_uint c = 0;
+
+    mp_uint_zero(rp + rn, n - rn);
+
+    if (tp) {
+        if (sign == negative) {
+            mp_add(rp, n, tp, pn, rp);
+        } else {
+            c = mp_sub(rp, n, tp, pn, rp);
+        }
+
+        mp_deallocate_uint(r->_alloc, tp, pn);
+    } else if (sign == negative) {
+        for (mp_size j = 0; j < bn; j++) {
+            mp_uint d = mp_addmul_uint(ap, an, bp[j], rp + j);
+
+            mp_add_uint(rp + j + an, n - j - an, d, rp + j + an);
+        }
+    } else {
+        for (mp_size j = 0; j < bn; j++) {
+            mp_uint d = mp_submul_uint(ap, an, bp[j], rp + j);
+
+            c |= mp_sub_uint(rp + j + an, n - j - an, d, rp + j + an);
+        }
+    }
+
+    if (c) {
+        mp_negate(rp, n, rp);
+        sign = !sign;
+    }
+
+    n = mp_bigint_normal_size(r, n);
+    r->_size = sign ? -n : n;
+
+    return MP_ERRC_OK;
+}
+
+static enum mp_errc mp_bigint_addmul_impl(const struct mp_bigint *a,
+                                          const struct mp_bigint *b,
+                                          mp_bool negative, struct mp_bigint *r)
+{
+    if (!a->_size || !b->_size) {
+        return MP_ERRC_OK;
+    }
+
+    mp_size an = mp_bigint_get_size(a);
+    mp_size bn = mp_bigint_get_size(b);
+
+    if (an >= bn) {
+        return mp_bigint_addmul_ord(a->_data, an, b->_data, bn, negative, r);
+    } else {
+        return mp_bigint_addmul_ord(b->_data, bn, a->_data, an, negative, r);
+    }
+}
+
+enum mp_errc mp_bigint_addmul(
+    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *r)
+{
+    return mp_bigint_addmul_impl(a, b, !mp_same_sign(a->_size, b->_size), r);
+}
+
+enum mp_errc mp_bigint_addmul_uint(
+    const struct mp_bigint *a, mp_uint b, struct mp_bigint *r)
+{
+    if (!a->_size || !b) {
+        return MP_ERRC_OK;
+    }
+
+    return mp_bigint_addmul_ord(
+        a->_data, mp_bigint_get_size(a), &b, 1, a->_size < 0, r);
+}
+
+enum mp_errc mp_bigint_submul(
+    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *r)
+{
+    return mp_bigint_addmul_impl(a, b, mp_same_sign(a->_size, b->_size), r);
+}
+
+enum mp_errc mp_bigint_submul_uint(
+    const struct mp_bigint *a, mp_uint b, struct mp_bigint *r)
+{
+    if (!a->_size || !b) {
+        return MP_ERRC_OK;
+    }
+
+    return mp_bigint_addmul_ord(
+        a->_data, mp_bigint_get_size(a), &b, 1, a->_size >= 0, r);
+}
+
+enum mp_bigint_round {
+    MP_BIGINT_ROUND_TRUNC,
+    MP_BIGINT_ROUND_FLOOR,
+    MP_BIGINT_ROUND_CEIL,
+};
+
+// q = a / b rounded as given and r = a - q b. The divisor is given either by
+// its limbs or prepared, in which case it is positive and only truncation is
+// supported. Either of q and r may be NULL.
+//
+// The truncated quotient is rounded away from zero when r is nonzero and a
+// and b have different signs for floor or the same sign for ceil. Then |q|
+// grows by one and r = sign(a) (|r| - |b|).
+
+static enum mp_errc mp_bigint_div_impl(const struct mp_bigint *a,
+                                       const mp_uint *bp, mp_size bn,
+                                       mp_bool positive,
+                                       const struct mp_divisor *div,
+                                       enum mp_bigint_round round,
+                                       struct mp_bigint *q, struct mp_bigint *r)
+{
+    MP_EXPECTS(q != r);
+    MP_EXPECTS(bp || round == MP_BIGINT_ROUND_TRUNC);
+
+    mp_size an = mp_bigint_get_size(a);
+
+    if (an < bn && round == MP_BIGINT_ROUND_TRUNC) {
+        if (r && mp_bigint_assign_copy(r, a)) {
+            return MP_ERRC_NOT_ENOUGH_MEMORY;
+        }
+
+        if (q) {
+            mp_bigint_assign_zero(q);
+        }
+
+        return MP_ERRC_OK;
+    }
+
+    struct mp_allocator *alloc = (r ? r : q)->_alloc;
+    mp_size qn = an >= bn ? an - bn + 1 : 1;
+    mp_size rn = bn;
+    struct mp_bigint qtmp, rtmp;
+    enum mp_errc ec = MP_ERRC_OK;
+
+    // without q, qtmp is an empty bigint, so that it can be destructed as is
+    if (q ? mp_bigint_construct_with_reserved(&qtmp, qn + 1, q->_alloc)
+          : mp_bigint_construct_uint(&qtmp, 0, alloc)) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    } else if (mp_bigint_construct_with_reserved(&rtmp, rn, alloc)) {
+        mp_bigint_destruct(&qtmp);
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_uint *qp = q ? qtmp._data : NULL;
+
+    if (an < bn) {
+        if (qp) {
+            *qp = 0;
+        }
+
+        mp_uint_copy(a->_data, an, rtmp._data);
+        mp_uint_zero(rtmp._data + an, rn - an);
+    } else if (div) {
+        ec = mp_div_pre(a->_data, an, div, qp, rtmp._data);
+    } else {
+        ec = mp_div_with_alloc(a->_data, an, bp, bn, qp, rtmp._data, alloc);
+    }
+
+    mp_bool r_positive = a->_size >= 0;
+    mp_bool q_positive = r_positive == positive;
+
+    if (!ec && round != MP_BIGINT_ROUND_TRUNC &&
+        mp_bigint_normal_size(&rtmp, rn) &&
+        q_positive == (round == MP_BIGINT_ROUND_CEIL)) {
+        if (qp) {
+            qp[qn] = mp_add_uint(qp, qn, 1, qp);
+            ++qn;
+        }
+
+        mp_sub_n(bp, rtmp._data, rn, rtmp._data);
+        r_positive = !r_positive;
+    }
+
+    if (!ec && r) {
+        rn = mp_bigint_normal_size(&rtmp, rn);
+        rtmp._size = r_positive ? rn : -rn;
+        mp_bigint_swap(r, &rtmp);
+    }
+
+    if (!ec && q) {
+        qn = mp_bigint_normal_size(&qtmp, qn);
+        qtmp._size = q_positive ? qn : -qn;
+        mp_bigint_swap(q, &qtmp);
+    }
+
+    mp_bigint_destruct(&qtmp);
+    mp_bigint_destruct(&rtmp);
+    return ec;
+}
+
 enum mp_errc mp_bigint_div(const struct mp_bigint *a, const struct mp_bigint *b,
-                           struct mp_bigint *q, struct mp_bigint *r);
+                           struct mp_bigint *q, struct mp_bigint *r)
+{
+    if (!b->_size) {
+        return MP_ERRC_DIVIDE_BY_ZERO;
+    }
+
+    return mp_bigint_div_impl(a, b->_data, mp_bigint_get_size(b),
+                              b->_size > 0, NULL, MP_BIGINT_ROUND_TRUNC, q, r);
+}
+
+enum mp_errc mp_bigint_tdiv(const struct mp_bigint *a,
+                            const struct mp_bigint *b, struct mp_bigint *q,
+                            struct mp_bigint *r)
+{
+    return mp_bigint_div(a, b, q, r);
+}
+
+enum mp_errc mp_bigint_fdiv(const struct mp_bigint *a,
+                            const struct mp_bigint *b, struct mp_bigint *q,
+                            struct mp_bigint *r)
+{
+    if (!b->_size) {
+        return MP_ERRC_DIVIDE_BY_ZERO;
+    }
+
+    return mp_bigint_div_impl(a, b->_data, mp_bigint_get_size(b),
+                              b->_size > 0, NULL, MP_BIGINT_ROUND_FLOOR, q, r);
+}
+
+enum mp_errc mp_bigint_cdiv(const struct mp_bigint *a,
+                            const struct mp_bigint *b, struct mp_bigint *q,
+                            struct mp_bigint *r)
+{
+    if (!b->_size) {
+        return MP_ERRC_DIVIDE_BY_ZERO;
+    }
+
+    return mp_bigint_div_impl(a, b->_data, mp_bigint_get_size(b),
+                              b->_size > 0, NULL, MP_BIGINT_ROUND_CEIL, q, r);
+}
 
 enum mp_errc mp_bigint_div_int(
     const struct mp_bigint *a, mp_int b, struct mp_bigint *q, mp_uint *r)
@@ -585,32 +879,142 @@ enum mp_errc mp_bigint_div_uint(
 {
     if (!b) {
         return MP_ERRC_DIVIDE_BY_ZERO;
-    } else if (!a) {
+    } else if (!a->_size) {
         mp_bigint_assign_zero(q);
         *r = 0;
         return MP_ERRC_OK;
     }
 
     mp_size an = mp_bigint_get_size(a);
+    mp_bool positive = a->_size > 0;
 
     if (mp_bigint_reserve(q, an)) {
         return MP_ERRC_NOT_ENOUGH_MEMORY;
     }
 
     *r = mp_div_uint(a->_data, an, b, q->_data);
-    q->_size = mp_bigint_normal_size(q, an);
+    an = mp_bigint_normal_size(q, an);
+    q->_size = positive ? an : -an;
 
     return MP_ERRC_OK;
 }
 
 enum mp_errc mp_bigint_mod(
-    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *r);
+    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *r)
+{
+    if (!b->_size) {
+        return MP_ERRC_DIVIDE_BY_ZERO;
+    }
+
+    return mp_bigint_div_impl(a, b->_data, mp_bigint_get_size(b),
+                              b->_size > 0, NULL, MP_BIGINT_ROUND_TRUNC, NULL,
+                              r);
+}
 
 enum mp_errc mp_bigint_mod_int(
-    const struct mp_bigint *a, mp_int b, struct mp_bigint *r);
+    const struct mp_bigint *a, mp_int b, struct mp_bigint *r)
+{
+    return mp_bigint_mod_uint(a, b >= 0 ? (mp_uint)b : -(mp_uint)b, r);
+}
 
 enum mp_errc mp_bigint_mod_uint(
-    const struct mp_bigint *a, mp_uint b, struct mp_bigint *r);
+    const struct mp_bigint *a, mp_uint b, struct mp_bigint *r)
+{
+    if (!b) {
+        return MP_ERRC_DIVIDE_BY_ZERO;
+    } else if (!a->_size) {
+        mp_bigint_assign_zero(r);
+        return MP_ERRC_OK;
+    }
+
+    mp_uint rem = mp_mod_uint(a->_data, mp_bigint_get_size(a), b);
+
+    if (!rem) {
+        mp_bigint_assign_zero(r);
+        return MP_ERRC_OK;
+    } else if (a->_size > 0) {
+        return mp_bigint_assign_uint_positive(r, rem);
+    } else {
+        return mp_bigint_assign_uint_negative(r, rem);
+    }
+}
+
+enum mp_errc mp_bigint_divisor_construct(
+    struct mp_divisor *div, const struct mp_bigint *b)
+{
+    if (!b->_size) {
+        return MP_ERRC_DIVIDE_BY_ZERO;
+    }
+
+    return mp_divisor_construct(
+        div, b->_data, mp_bigint_get_size(b), b->_alloc);
+}
+
+enum mp_errc mp_bigint_div_pre(const struct mp_bigint *a,
+                               const struct mp_divisor *div,
+                               struct mp_bigint *q, struct mp_bigint *r)
+{
+    return mp_bigint_div_impl(
+        a, NULL, div->_size, mp_true, div, MP_BIGINT_ROUND_TRUNC, q, r);
+}
+
+enum mp_errc mp_bigint_mod_pre(const struct mp_bigint *a,
+                               const struct mp_divisor *div,
+                               struct mp_bigint *r)
+{
+    return mp_bigint_div_impl(
+        a, NULL, div->_size, mp_true, div, MP_BIGINT_ROUND_TRUNC, NULL, r);
+}
+
+enum mp_errc mp_bigint_divexact(
+    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *q)
+{
+    if (!b->_size) {
+        return MP_ERRC_DIVIDE_BY_ZERO;
+    }
+
+    mp_size an = mp_bigint_get_size(a);
+    mp_size bn = mp_bigint_get_size(b);
+
+    if (an < bn) {
+        MP_EXPECTS(!an);
+        mp_bigint_assign_zero(q);
+        return MP_ERRC_OK;
+    }
+
+    mp_size qn = an - bn + 1;
+    struct mp_bigint tmp;
+    enum mp_errc ec;
+
+    if (mp_bigint_construct_with_reserved(&tmp, qn, q->_alloc)) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    ec = mp_divexact_with_alloc(
+        a->_data, an, b->_data, bn, tmp._data, q->_alloc);
+
+    if (!ec) {
+        qn = mp_bigint_normal_size(&tmp, qn);
+        tmp._size = (a->_size > 0) == (b->_size > 0) ? qn : -qn;
+        mp_bigint_swap(q, &tmp);
+    }
+
+    mp_bigint_destruct(&tmp);
+    return ec;
+}
+
+mp_bool mp_bigint_divisible_uint(const struct mp_bigint *a, mp_uint b)
+{
+    MP_EXPECTS(b);
+
+    return !a->_size || mp_divisible_uint(a->_data, mp_bigint_get_size(a), b);
+}
+
+mp_bool mp_bigint_divisible_2exp(const struct mp_bigint *a, mp_size k)
+{
+    return !a->_size ||
+           mp_divisible_2exp(a->_data, mp_bigint_get_size(a), k);
+}
 
 // ~a = -(a + 1)
 
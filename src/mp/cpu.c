@@ -0,0 +1,258 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mp/config.h>
+#include <mp/mp.h>
+#include "./util.h"
+
+#if MP_ASM_X86_64
+#include <cpuid.h>
+#endif
+
+// The kernels start out bound to the portable versions, so that the library
+// works before the constructor below has run, and are rebound from the
+// detected features, as MP_CPU_FEATURES narrows them.
+
+#define MP_KERNELS_GENERIC                                                     \
+    {                                                                          \
+        .add_n = mp_add_n_generic,                                             \
+        .sub_n = mp_sub_n_generic,                                             \
+        .mul_uint = mp_mul_uint_generic,                                       \
+        .addmul_uint = mp_addmul_uint_generic,                                 \
+        .submul_uint = mp_submul_uint_generic,                                 \
+        .mul_basecase = mp_mul_basecase_generic,                               \
+        .bit_and_n = mp_bit_and_n_generic,                                     \
+        .bit_or_n = mp_bit_or_n_generic,                                       \
+        .bit_xor_n = mp_bit_xor_n_generic,                                     \
+        .bit_not = mp_bit_not_generic,                                         \
+        .left_shift = mp_left_shift_generic,                                   \
+        .right_shift = mp_right_shift_generic,                                 \
+        .popcount = mp_popcount_generic,                                       \
+        .hamming_n = mp_hamming_n_generic,                                     \
+        .scan_10 = mp_scan_10_generic,                                         \
+        .scan_16 = mp_scan_16_generic,                                         \
+        .store_be = mp_store_be_generic,                                       \
+        .load_be = mp_load_be_generic,                                         \
+    }
+
+struct mp_kernels mp_kernels = MP_KERNELS_GENERIC;
+
+static _Atomic unsigned mp_kernel_features = 0;
+
+#if MP_ASM_X86_64
+
+static uint64_t mp_cpu_xgetbv(unsigned index)
+{
+    uint32_t lo, hi;
+
+    asm("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+    return (uint64_t)hi << 32 | lo;
+}
+
+// AVX2 and AVX-512 also need the OS to save their registers on a context
+// switch, which it does for the register states whose bits XCR0 has set
+
+static unsigned mp_cpu_detect(void)
+{
+    unsigned features = MP_CPU_FEATURE_X86_64;
+    unsigned a, b, c, d;
+
+    if (!__get_cpuid(1, &a, &b, &c, &d)) {
+        return features;
+    }
+
+    mp_bool avx = (c >> 27 & 1) && (c >> 28 & 1);
+    uint64_t xcr0 = avx ? mp_cpu_xgetbv(0) : 0;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return features;
+    }
+
+    __cpuid_count(7, 0, a, b, c, d);
+
+    if (b >> 8 & 1) {
+        features |= MP_CPU_FEATURE_BMI2;
+    }
+
+    if (b >> 19 & 1) {
+        features |= MP_CPU_FEATURE_ADX;
+    }
+
+    if ((b >> 5 & 1) && (xcr0 & 0x06) == 0x06) {
+        features |= MP_CPU_FEATURE_AVX2;
+    }
+
+    if ((b >> 16 & 1) && (b >> 30 & 1) && (xcr0 & 0xe6) == 0xe6) {
+        features |= MP_CPU_FEATURE_AVX512;
+    }
+
+    return features;
+}
+
+#else
+
+static unsigned mp_cpu_detect(void)
+{
+    return 0;
+}
+
+#endif
+
+unsigned mp_get_cpu_features(void)
+{
+    static _Atomic unsigned detected = 0;
+    static _Atomic mp_bool done = mp_false;
+
+    if (!atomic_load(&done)) {
+        atomic_store(&detected, mp_cpu_detect());
+        atomic_store(&done, mp_true);
+    }
+
+    return atomic_load(&detected);
+}
+
+unsigned mp_get_kernel_features(void)
+{
+    return atomic_load(&mp_kernel_features);
+}
+
+static void mp_kernels_bind(unsigned features)
+{
+    struct mp_kernels k = MP_KERNELS_GENERIC;
+
+#if MP_ASM_X86_64
+    if (features & MP_CPU_FEATURE_X86_64) {
+        k.add_n = mp_add_n_x86_64;
+        k.sub_n = mp_sub_n_x86_64;
+    }
+
+    if ((features & MP_CPU_FEATURE_BMI2) && (features & MP_CPU_FEATURE_ADX)) {
+        k.mul_uint = mp_mul_uint_adx;
+        k.addmul_uint = mp_addmul_uint_adx;
+        k.submul_uint = mp_submul_uint_adx;
+        k.mul_basecase = mp_mul_basecase_adx;
+    }
+#endif
+
+#if MP_SIMD_X86_64
+    if (features & MP_CPU_FEATURE_AVX2) {
+        k.bit_and_n = mp_bit_and_n_avx2;
+        k.bit_or_n = mp_bit_or_n_avx2;
+        k.bit_xor_n = mp_bit_xor_n_avx2;
+        k.bit_not = mp_bit_not_avx2;
+        k.left_shift = mp_left_shift_avx2;
+        k.right_shift = mp_right_shift_avx2;
+        k.popcount = mp_popcount_avx2;
+        k.hamming_n = mp_hamming_n_avx2;
+        k.scan_10 = mp_scan_10_avx2;
+        k.scan_16 = mp_scan_16_avx2;
+        k.store_be = mp_store_be_avx2;
+        k.load_be = mp_load_be_avx2;
+    }
+
+    if (features & MP_CPU_FEATURE_AVX512) {
+        k.bit_and_n = mp_bit_and_n_avx512;
+        k.bit_or_n = mp_bit_or_n_avx512;
+        k.bit_xor_n = mp_bit_xor_n_avx512;
+        k.bit_not = mp_bit_not_avx512;
+        k.popcount = mp_popcount_avx512;
+        k.hamming_n = mp_hamming_n_avx512;
+    }
+#endif
+
+    atomic_store(&mp_kernels.add_n, k.add_n);
+    atomic_store(&mp_kernels.sub_n, k.sub_n);
+    atomic_store(&mp_kernels.mul_uint, k.mul_uint);
+    atomic_store(&mp_kernels.addmul_uint, k.addmul_uint);
+    atomic_store(&mp_kernels.submul_uint, k.submul_uint);
+    atomic_store(&mp_kernels.mul_basecase, k.mul_basecase);
+    atomic_store(&mp_kernels.bit_and_n, k.bit_and_n);
+    atomic_store(&mp_kernels.bit_or_n, k.bit_or_n);
+    atomic_store(&mp_kernels.bit_xor_n, k.bit_xor_n);
+    atomic_store(&mp_kernels.bit_not, k.bit_not);
+    atomic_store(&mp_kernels.left_shift, k.left_shift);
+    atomic_store(&mp_kernels.right_shift, k.right_shift);
+    atomic_store(&mp_kernels.popcount, k.popcount);
+    atomic_store(&mp_kernels.hamming_n, k.hamming_n);
+    atomic_store(&mp_kernels.scan_10, k.scan_10);
+    atomic_store(&mp_kernels.scan_16, k.scan_16);
+    atomic_store(&mp_kernels.store_be, k.store_be);
+    atomic_store(&mp_kernels.load_be, k.load_be);
+}
+
+unsigned mp_set_kernel_features(unsigned features)
+{
+    features &= mp_get_cpu_features();
+    mp_kernels_bind(features);
+    return atomic_exchange(&mp_kernel_features, features);
+}
+
+static const struct {
+    const char *name;
+    unsigned feature;
+} mp_cpu_feature_names[] = {
+    {"x86_64", MP_CPU_FEATURE_X86_64},
+    {"bmi2", MP_CPU_FEATURE_BMI2},
+    {"adx", MP_CPU_FEATURE_ADX},
+    {"avx2", MP_CPU_FEATURE_AVX2},
+    {"avx512", MP_CPU_FEATURE_AVX512},
+};
+
+// A list that starts with a name replaces the detected set. Unknown names
+// are ignored, so that a setting written for another build or a newer
+// version still applies the parts that are understood
+
+static unsigned mp_cpu_features_from_env(unsigned features)
+{
+    const char *first = getenv("MP_CPU_FEATURES");
+
+    if (!first) {
+        return features;
+    }
+
+    if (*first && *first != '-') {
+        features = 0;
+    }
+
+    while (*first) {
+        const char *last = strchr(first, ',');
+        mp_bool remove = *first == '-';
+
+        if (!last) {
+            last = first + strlen(first);
+        }
+
+        const char *name = first + remove;
+        mp_size len = last - name;
+
+        if (len == 4 && !memcmp(name, "none", 4)) {
+            features = 0;
+        }
+
+        for (mp_size i = 0; i < sizeof(mp_cpu_feature_names) /
+                                    sizeof(*mp_cpu_feature_names);
+             i++) {
+            const char *s = mp_cpu_feature_names[i].name;
+
+            if (strlen(s) == len && !memcmp(name, s, len)) {
+                if (remove) {
+                    features &= ~mp_cpu_feature_names[i].feature;
+                } else {
+                    features |= mp_cpu_feature_names[i].feature;
+                }
+            }
+        }
+
+        first = *last ? last + 1 : last;
+    }
+
+    return features;
+}
+
+#if MP_GCC || MP_CLANG
+__attribute__((constructor))
+#endif
+static void mp_kernels_init(void)
+{
+    mp_set_kernel_features(mp_cpu_features_from_env(mp_get_cpu_features()));
+}
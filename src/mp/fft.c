@@ -0,0 +1,383 @@
+#include <mp/config.h>
+#include <mp/memory.h>
+#include <mp/mp.h>
+#include "./util.h"
+
+// Schönhage–Strassen multiplication. The operands are cut into pieces of m
+// limbs, which become the coefficients of two polynomials over the ring
+// Z / (2^(n W) + 1), where n is chosen so that no coefficient of the product
+// can overflow the ring and there are enough pieces for the product to not
+// wrap around. With K = 2^k pieces, 2^(n W / K) is a 2K-th root of unity, so
+// the negacyclic convolution is a weighted length K cyclic convolution whose
+// twiddle factors are all powers of two.
+//
+// Ring elements take n + 1 limbs and are kept normalized to [0, 2^(n W)].
+
+struct mp_fft_params {
+    mp_size k;
+    mp_size m;
+    mp_size n;
+};
+
+// a = a mod 2^(n W) + 1, where the top limb a[n] is read as signed
+
+static void mp_fft_norm(mp_uint *ap, mp_size n)
+{
+    mp_int top = (mp_int)ap[n];
+
+    ap[n] = 0;
+
+    if (top > 0) {
+        if (mp_sub_uint(ap, n, top, ap)) {
+            ap[n] = mp_add_uint(ap, n, 1, ap);
+        }
+    } else if (top < 0) {
+        if (mp_add_uint(ap, n, -top, ap) && mp_sub_uint(ap, n, 1, ap)) {
+            ap[n] = mp_add_uint(ap, n, 1, ap);
+        }
+    }
+}
+
+static mp_bool mp_fft_is_zero(const mp_uint *ap, mp_size n)
+{
+    for (mp_size i = 0; i <= n; i++) {
+        if (ap[i]) {
+            return mp_false;
+        }
+    }
+
+    return mp_true;
+}
+
+// a = -a mod 2^(n W) + 1
+
+static void mp_fft_neg(mp_uint *ap, mp_size n)
+{
+    if (mp_fft_is_zero(ap, n)) {
+        return;
+    } else if (ap[n]) {
+        ap[n] = 0;
+        ap[0] = 1;
+        mp_uint_zero(ap + 1, n - 1);
+    } else {
+        mp_negate(ap, n, ap);
+        ap[n] = mp_add_uint(ap, n, 1, ap);
+    }
+}
+
+static void mp_fft_add(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    mp_add_n(ap, bp, n + 1, rp);
+    mp_fft_norm(rp, n);
+}
+
+static void mp_fft_sub(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    mp_sub_n(ap, bp, n + 1, rp);
+    mp_fft_norm(rp, n);
+}
+
+// r = a 2^e mod 2^(n W) + 1, for 0 <= e < 2 n W. The limb rotation is done
+// first, using B^n = -1, and the remaining bit shift folds back at most b
+// bits.
+
+static void mp_fft_mul_2exp(
+    const mp_uint *ap, mp_size e, mp_size n, mp_uint *rp)
+{
+    MP_EXPECTS(ap != rp);
+
+    mp_bool neg = e >= n * MP_UINT_WIDTH;
+
+    if (neg) {
+        e -= n * MP_UINT_WIDTH;
+    }
+
+    mp_size q = e / MP_UINT_WIDTH;
+    mp_size b = e % MP_UINT_WIDTH;
+
+    if (q) {
+        mp_uint c = !mp_negate(ap + n - q, q, rp);
+
+        mp_uint_copy(ap, n - q, rp + q);
+        rp[n] = -mp_sub_uint(rp + q, n - q, c + ap[n], rp + q);
+    } else {
+        mp_uint_copy(ap, n + 1, rp);
+    }
+
+    mp_fft_norm(rp, n);
+
+    if (b && rp[n]) {
+        // -2^b
+        rp[0] = 1 - ((mp_uint)1 << b);
+        mp_uint_fill(rp + 1, n - 1, MP_UINT_MAX);
+        rp[n] = 0;
+    } else if (b) {
+        mp_left_shift(rp, n + 1, b, rp);
+        mp_fft_norm(rp, n);
+    }
+
+    if (neg) {
+        mp_fft_neg(rp, n);
+    }
+}
+
+// r = a b mod 2^(n W) + 1. The scratch t takes 2n limbs.
+
+static void mp_fft_mul_mod(const mp_uint *ap, const mp_uint *bp, mp_size n,
+                           mp_uint *rp, mp_uint *tp, struct mp_allocator *alloc)
+{
+    if (ap[n]) {
+        mp_uint_copy(bp, n + 1, rp);
+        mp_fft_neg(rp, n);
+    } else if (bp[n]) {
+        mp_uint_copy(ap, n + 1, rp);
+        mp_fft_neg(rp, n);
+    } else {
+        if (ap == bp) {
+            mp_sqr_with_alloc(ap, n, tp, alloc);
+        } else {
+            mp_mul_with_alloc(ap, n, bp, n, tp, alloc);
+        }
+
+        rp[n] = -mp_sub_n(tp, tp + n, n, rp);
+        mp_fft_norm(rp, n);
+    }
+}
+
+// Forward transform, decimation in frequency. Leaves the output in bit
+// reversed order.
+
+static void mp_fft_forward(mp_uint *xp, mp_size k, mp_size n, mp_uint *tp)
+{
+    mp_size stride = n + 1;
+    mp_size size = (mp_size)1 << k;
+    mp_size nbits = n * MP_UINT_WIDTH;
+    mp_uint *up = tp;
+
+    for (mp_size len = size / 2; len; len /= 2) {
+        for (mp_size first = 0; first < size; first += 2 * len) {
+            for (mp_size j = 0; j < len; j++) {
+                mp_uint *x0 = xp + (first + j) * stride;
+                mp_uint *x1 = x0 + len * stride;
+
+                mp_fft_sub(x0, x1, n, up);
+                mp_fft_add(x0, x1, n, x0);
+
+                if (j) {
+                    mp_fft_mul_2exp(up, j * (nbits / len), n, x1);
+                } else {
+                    mp_uint_copy(up, stride, x1);
+                }
+            }
+        }
+    }
+}
+
+// Inverse transform, decimation in time. Takes its input in bit reversed
+// order and leaves the output scaled by 2^k.
+
+static void mp_fft_inverse(mp_uint *xp, mp_size k, mp_size n, mp_uint *tp)
+{
+    mp_size stride = n + 1;
+    mp_size size = (mp_size)1 << k;
+    mp_size nbits = n * MP_UINT_WIDTH;
+    mp_uint *up = tp;
+
+    for (mp_size len = 1; len < size; len *= 2) {
+        for (mp_size first = 0; first < size; first += 2 * len) {
+            for (mp_size j = 0; j < len; j++) {
+                mp_uint *x0 = xp + (first + j) * stride;
+                mp_uint *x1 = x0 + len * stride;
+
+                if (j) {
+                    mp_fft_mul_2exp(x1, 2 * nbits - j * (nbits / len), n, up);
+                } else {
+                    mp_uint_copy(x1, stride, up);
+                }
+
+                mp_fft_sub(x0, up, n, x1);
+                mp_fft_add(x0, up, n, x0);
+            }
+        }
+    }
+}
+
+// Cuts a into pieces of m limbs, weighting piece i by 2^(i n W / K).
+
+static void mp_fft_decompose(const mp_uint *ap, mp_size an,
+                             const struct mp_fft_params *params, mp_uint *xp,
+                             mp_uint *tp)
+{
+    mp_size k = params->k;
+    mp_size m = params->m;
+    mp_size n = params->n;
+    mp_size size = (mp_size)1 << k;
+    mp_size step = n * MP_UINT_WIDTH / size;
+
+    for (mp_size i = 0; i < size; i++) {
+        mp_uint *x = xp + i * (n + 1);
+        mp_size first = i * m;
+
+        if (first >= an) {
+            mp_uint_zero(x, n + 1);
+            continue;
+        }
+
+        mp_size count = an - first < m ? an - first : m;
+
+        mp_uint_copy(ap + first, count, x);
+        mp_uint_zero(x + count, n + 1 - count);
+
+        if (i) {
+            mp_uint_copy(x, n + 1, tp);
+            mp_fft_mul_2exp(tp, i * step, n, x);
+        }
+    }
+}
+
+// r = sum of c_i B^(i m), after removing the weights and the 2^k scaling
+
+static void mp_fft_recompose(mp_uint *xp, const struct mp_fft_params *params,
+                             mp_uint *rp, mp_size rn, mp_uint *tp)
+{
+    mp_size k = params->k;
+    mp_size m = params->m;
+    mp_size n = params->n;
+    mp_size size = (mp_size)1 << k;
+    mp_size nbits = n * MP_UINT_WIDTH;
+    mp_size step = nbits / size;
+
+    mp_uint_zero(rp, rn);
+
+    for (mp_size i = 0; i < size && i * m < rn; i++) {
+        mp_uint *x = xp + i * (n + 1);
+        mp_size first = i * m;
+        mp_size count = rn - first < n ? rn - first : n;
+        mp_uint c;
+
+        mp_uint_copy(x, n + 1, tp);
+        mp_fft_mul_2exp(tp, 2 * nbits - k - i * step, n, x);
+        MP_ENSURES(!x[n]);
+
+        c = mp_add_n(rp + first, x, count, rp + first);
+
+        for (mp_size j = first + count; c && j < rn; j++) {
+            c = !++rp[j];
+        }
+    }
+}
+
+static void mp_fft_choose_params(
+    mp_size an, mp_size bn, mp_size k, struct mp_fft_params *params)
+{
+    mp_size size = (mp_size)1 << k;
+    mp_size m = (an + bn + size - 1) / size;
+
+    while ((an + m - 1) / m + (bn + m - 1) / m - 1 > size) {
+        ++m;
+    }
+
+    // the coefficients are below K 2^(2 m W), and n W must be a multiple of K
+    mp_size bits = 2 * m * MP_UINT_WIDTH + k + 1;
+    mp_size n = (bits + MP_UINT_WIDTH - 1) / MP_UINT_WIDTH;
+    mp_size align = size > MP_UINT_WIDTH ? size / MP_UINT_WIDTH : 1;
+
+    params->k = k;
+    params->m = m;
+    params->n = (n + align - 1) / align * align;
+}
+
+static mp_size mp_fft_isqrt(mp_size x)
+{
+    mp_size r = x;
+    mp_size y = (x + 1) / 2;
+
+    while (y < r) {
+        r = y;
+        y = (y + x / y) / 2;
+    }
+
+    return r;
+}
+
+// Picks k by balancing the transform cost, K n k, against the pointwise
+// products, K M(n), where M(n) is taken to be n^1.5.
+
+static mp_size mp_fft_cost(const struct mp_fft_params *params)
+{
+    mp_size size = (mp_size)1 << params->k;
+    return size * params->n * (2 * params->k + mp_fft_isqrt(params->n));
+}
+
+static void mp_fft_best_params(
+    mp_size an, mp_size bn, struct mp_fft_params *params)
+{
+    mp_fft_choose_params(an, bn, 4, params);
+
+    mp_size best_cost = mp_fft_cost(params);
+
+    for (mp_size k = 5; k <= 20; k++) {
+        struct mp_fft_params p;
+
+        mp_fft_choose_params(an, bn, k, &p);
+
+        mp_size cost = mp_fft_cost(&p);
+
+        if (cost < best_cost) {
+            best_cost = cost;
+            *params = p;
+        }
+    }
+}
+
+enum mp_errc mp_mul_fft(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                        mp_size bn, mp_uint *rp, struct mp_allocator *alloc)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
+
+    struct mp_fft_params params;
+
+    mp_fft_best_params(an, bn, &params);
+
+    mp_size k = params.k;
+    mp_size n = params.n;
+    mp_size size = (mp_size)1 << k;
+    mp_size xn = size * (n + 1);
+    mp_size tn = 2 * xn + 2 * n + 2;
+    mp_uint *xp = mp_allocate_uint(alloc, tn);
+
+    if (!xp) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_uint *yp = xp + xn;
+    mp_uint *tp = yp + xn;
+
+    mp_bool sqr = ap == bp && an == bn;
+
+    mp_fft_decompose(ap, an, &params, xp, tp);
+    mp_fft_forward(xp, k, n, tp);
+
+    if (sqr) {
+        yp = xp;
+    } else {
+        mp_fft_decompose(bp, bn, &params, yp, tp);
+        mp_fft_forward(yp, k, n, tp);
+    }
+
+    for (mp_size i = 0; i < size; i++) {
+        mp_uint *x = xp + i * (n + 1);
+        mp_uint *y = yp + i * (n + 1);
+
+        mp_fft_mul_mod(x, y, n, x, tp, alloc);
+    }
+
+    mp_fft_inverse(xp, k, n, tp);
+    mp_fft_recompose(xp, &params, rp, an + bn, tp);
+
+    mp_deallocate_uint(alloc, xp, tn);
+    return MP_ERRC_OK;
+}
@@ -1,3 +1,4 @@
+#include <stdatomic.h>
 #include <mp/config.h>
 #include <mp/mp.h>
 #include "./util.h"
@@ -12,12 +13,17 @@ mp_uint mp_add_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
 
         b = r < b;
         *rp++ = r;
-    } while (--an);
+    } while (--an && b);
+
+    if (ap != rp) {
+        mp_uint_copy(ap, an, rp);
+    }
 
     return b;
 }
 
-mp_uint mp_add_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+mp_uint mp_add_n_generic(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
 {
     MP_EXPECTS(n);
 
@@ -34,6 +40,11 @@ mp_uint mp_add_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
     return c;
 }
 
+mp_uint mp_add_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    return MP_KERNEL(add_n)(ap, bp, n, rp);
+}
+
 mp_uint mp_add(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
                mp_uint *rp)
 {
@@ -59,12 +70,17 @@ mp_uint mp_sub_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
 
         b = a < b;
         *rp++ = r;
-    } while (--an);
+    } while (--an && b);
+
+    if (ap != rp) {
+        mp_uint_copy(ap, an, rp);
+    }
 
     return b;
 }
 
-mp_uint mp_sub_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+mp_uint mp_sub_n_generic(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
 {
     MP_EXPECTS(n);
 
@@ -74,13 +90,18 @@ mp_uint mp_sub_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
         mp_uint b = *bp++ + c;
         mp_uint r = a - b;
 
-        c = b < c;
+        c = (b < c) + (a < b);
         *rp++ = r;
     } while (--n);
 
     return c;
 }
 
+mp_uint mp_sub_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    return MP_KERNEL(sub_n)(ap, bp, n, rp);
+}
+
 mp_uint mp_sub(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
                mp_uint *rp)
 {
@@ -98,7 +119,7 @@ mp_uint mp_sub(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
 
 // r += a * b
 
-static mp_uint mp_addmul_uint(
+mp_uint mp_addmul_uint_generic(
     const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
 {
     MP_EXPECTS(an);
@@ -118,27 +139,40 @@ static mp_uint mp_addmul_uint(
     return c;
 }
 
-// static mp_uint mp_submul_uint(
-//     const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
-// {
-//     MP_EXPECTS(an);
+mp_uint mp_addmul_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
+{
+    return MP_KERNEL(addmul_uint)(ap, an, b, rp);
+}
 
-//     mp_uint c = 0;
-//     do {
-//         mp_uint a = *ap++;
-//         mp_uint r = *rp;
-//         mp_uint hi, lo = mp_uint_mul(a, b, &hi);
+// r -= a * b
+
+mp_uint mp_submul_uint_generic(
+    const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
+{
+    MP_EXPECTS(an);
 
-//         lo += c;
-//         c = hi + (lo < c) + (r < lo);
-//         r -= lo;
-//         *rp++ = r;
-//     } while (--an);
+    mp_uint c = 0;
+    do {
+        mp_uint a = *ap++;
+        mp_uint r = *rp;
+        mp_uint hi, lo = mp_uint_mul(a, b, &hi);
 
-//     return c;
-// }
+        lo += c;
+        c = hi + (lo < c) + (r < lo);
+        r -= lo;
+        *rp++ = r;
+    } while (--an);
 
-mp_uint mp_mul_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
+    return c;
+}
+
+mp_uint mp_submul_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
+{
+    return MP_KERNEL(submul_uint)(ap, an, b, rp);
+}
+
+mp_uint mp_mul_uint_generic(
+    const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
 {
     MP_EXPECTS(an);
 
@@ -155,442 +189,3466 @@ mp_uint mp_mul_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
     return c;
 }
 
-mp_uint mp_mul(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
-               mp_uint *rp)
+mp_uint mp_mul_uint(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
+{
+    return MP_KERNEL(mul_uint)(ap, an, b, rp);
+}
+
+// r = |a - b|, returns whether a < b
+
+static mp_bool mp_sub_abs(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                          mp_size bn, mp_uint *rp)
 {
     MP_EXPECTS(an >= bn);
     MP_EXPECTS(bn);
 
-    mp_uint c = mp_mul_uint(ap, an, *bp, rp);
-
-    while (--bn) {
-        rp[an] = c;
-        c = mp_addmul_uint(++ap, --an, *++bp, ++rp);
+    for (mp_size i = bn; i < an; i++) {
+        if (ap[i]) {
+            mp_sub(ap, an, bp, bn, rp);
+            return mp_false;
+        }
     }
 
-    return c;
+    mp_uint_zero(rp + bn, an - bn);
+
+    if (mp_cmp_n(ap, bp, bn) >= 0) {
+        mp_sub_n(ap, bp, bn, rp);
+        return mp_false;
+    } else {
+        mp_sub_n(bp, ap, bn, rp);
+        return mp_true;
+    }
 }
 
-mp_uint mp_div_uint(const mp_uint *np, mp_size nn, mp_uint d, mp_uint *qp)
-{
-    MP_EXPECTS(nn);
-    MP_EXPECTS(d);
+// a /= 3, a is known to be a multiple of 3 in two's complement
 
-    if (d >> (MP_UINT_WIDTH - 1)) {
-        mp_uint v = mp_uint_inv(d);
-        mp_uint r = 0;
-        mp_uint q;
+static void mp_divexact_by3(mp_uint *ap, mp_size an)
+{
+    mp_uint inv = MP_UINT_MAX / 3 * 2 + 1;
+    mp_uint c = 0;
 
-        do {
-            q = np[--nn];
-            qp[nn] = mp_uint_div_inv(r, q, d, v, &r);
-        } while (nn);
+    do {
+        mp_uint a = *ap;
+        mp_uint q = (a - c) * inv;
+        mp_uint hi;
 
-        return r;
-    } else {
-        mp_uint lshift = mp_uint_countl_zero(d);
-        mp_uint rshift = MP_UINT_WIDTH - lshift;
-        mp_uint v = mp_uint_inv(d <<= lshift);
-        mp_uint q = 0;
-        mp_uint r = 0;
+        mp_uint_mul(q, 3, &hi);
+        c = hi + (a < c);
+        *ap++ = q;
+    } while (--an);
+}
 
-        do {
-            mp_uint next = np[--nn];
+// a /= 2, a is known to be even in two's complement
 
-            q = q << lshift | next >> rshift;
-            qp[nn] = mp_uint_div_inv(r, q, d, v, &r);
-            q = next;
-        } while (--nn);
+static void mp_divexact_by2_signed(mp_uint *ap, mp_size an)
+{
+    mp_uint sign = ap[an - 1] & ((mp_uint)1 << (MP_UINT_WIDTH - 1));
 
-        *qp = mp_uint_div_inv(r, q << lshift, d, v, &r);
-        return r >> rshift;
-    }
+    mp_right_shift(ap, an, 1, ap);
+    ap[an - 1] |= sign;
 }
 
-void mp_div(const mp_uint *np, mp_uint nn, const mp_uint *dp, mp_size dn,
-            mp_uint *qp, mp_uint *rp);
+// r += a, a is clipped to the length of r
 
-void mp_mod_uint(const mp_uint *np, mp_uint nn, mp_uint d, mp_uint *rp);
+static void mp_add_clipped(mp_uint *rp, mp_size rn, const mp_uint *ap,
+                           mp_size an)
+{
+    mp_add(rp, rn, ap, an < rn ? an : rn, rp);
+}
 
-void mp_mod(const mp_uint *np, mp_uint nn, const mp_uint *dp, mp_size dn,
-            mp_uint *rp);
+// r += a (b0 + b1 B), for r of an limbs. Sets r_an and returns the limb above
+// it.
+//
+// Column i takes r_i, the low half of a_i b0 and the carry c0, and column
+// i + 1 the high half of a_i b0, the low half of a_i b1 and the carry c1. Both
+// sums fit in two limbs, so each column hands on a single limb.
 
-mp_uint mp_left_shift(const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp)
+static mp_uint mp_addmul_2(
+    const mp_uint *ap, mp_size an, const mp_uint *bp, mp_uint *rp)
 {
     MP_EXPECTS(an);
-    MP_EXPECTS(bits < MP_UINT_WIDTH);
-    MP_EXPECTS(bits);
 
-    mp_uint rbits = MP_UINT_WIDTH - bits;
-    mp_uint next = ap[--an];
-    mp_uint ret = next >> rbits;
+    mp_uint b0 = bp[0];
+    mp_uint b1 = bp[1];
+    mp_uint c0 = 0, c1 = 0;
 
-    while (an) {
-        mp_uint prev = ap[--an];
-        rp[an + 1] = (next << bits) | (prev >> rbits);
-    }
+    do {
+        mp_uint a = *ap++;
+        mp_uint r = *rp;
+        mp_uint h0, l0 = mp_uint_mul(a, b0, &h0);
+        mp_uint h1, l1 = mp_uint_mul(a, b1, &h1);
 
-    *rp = next << bits;
-    return ret;
+        l0 += c0;
+        h0 += l0 < c0;
+        r += l0;
+        h0 += r < l0;
+        *rp++ = r;
+
+        l1 += c1;
+        h1 += l1 < c1;
+        c0 = l1 + h0;
+        c1 = h1 + (c0 < h0);
+    } while (--an);
+
+    *rp = c0;
+    return c1;
 }
 
-mp_uint mp_right_shift(const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp)
+// Takes the rows of b two at a time, which halves the passes over r
+
+void mp_mul_basecase_generic(
+    const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn, mp_uint *rp)
 {
-    MP_EXPECTS(an);
-    MP_EXPECTS(bits < MP_UINT_WIDTH);
-    MP_EXPECTS(bits);
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
 
-    mp_uint lbits = MP_UINT_WIDTH - bits;
-    mp_uint prev = *ap;
+    rp[an] = mp_mul_uint_generic(ap, an, *bp, rp);
 
-    while (--an) {
-        mp_uint next = *++ap;
-        *rp++ = (prev >> bits) | (next << lbits);
-        prev = next;
+    for (; bn > 2; bp += 2, rp += 2, bn -= 2) {
+        rp[an + 2] = mp_addmul_2(ap, an, bp + 1, rp + 1);
     }
 
-    return prev << lbits;
+    if (bn == 2) {
+        rp[an + 1] = mp_addmul_uint_generic(ap, an, bp[1], rp + 1);
+    }
 }
 
-void mp_bit_and_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+static inline void mp_mul_basecase(
+    const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn, mp_uint *rp)
 {
-    MP_EXPECTS(n);
-
-    do {
-        *rp++ = *ap++ & *bp++;
-    } while (--n);
+    MP_KERNEL(mul_basecase)(ap, an, bp, bn, rp);
 }
 
-void mp_bit_and(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
-                mp_uint *rp)
-{
-    MP_EXPECTS(an >= bn);
-    MP_EXPECTS(bn);
+static void mp_mul_rec(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                       mp_size bn, mp_uint *rp, mp_uint *tp);
 
-    mp_bit_and_n(ap, bp, bn, rp);
-    mp_uint_zero(rp + bn, an - bn);
-}
+// a = a1 B^h + a0
+// b = b1 B^h + b0
+// a b = a1 b1 B^2h + (a0 b0 + a1 b1 - (a0 - a1)(b0 - b1)) B^h + a0 b0
 
-void mp_bit_or_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+static void mp_mul_karatsuba(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                             mp_size bn, mp_uint *rp, mp_uint *tp)
 {
-    MP_EXPECTS(n);
+    mp_size h = (an + 1) / 2;
+    mp_size s = an - h;
+    mp_size t = bn - h;
 
-    do {
-        *rp++ = *ap++ | *bp++;
-    } while (--n);
+    MP_EXPECTS(s >= t);
+    MP_EXPECTS(t);
+
+    mp_uint *da = tp;
+    mp_uint *db = tp + h;
+    mp_uint *zm = tp + 2 * h + 1;
+    mp_uint *sp = tp + 4 * h + 1;
+    mp_uint *w = tp;
+    mp_bool neg = mp_sub_abs(ap, h, ap + h, s, da) ^
+                  mp_sub_abs(bp, h, bp + h, t, db);
+
+    mp_mul_rec(da, h, db, h, zm, sp);
+    mp_mul_rec(ap, h, bp, h, rp, sp);
+    mp_mul_rec(ap + h, s, bp + h, t, rp + 2 * h, sp);
+
+    w[2 * h] = mp_add(rp, 2 * h, rp + 2 * h, s + t, w);
+
+    if (neg) {
+        mp_add(w, 2 * h + 1, zm, 2 * h, w);
+    } else {
+        mp_sub(w, 2 * h + 1, zm, 2 * h, w);
+    }
+
+    mp_add_clipped(rp + h, an + bn - h, w, 2 * h + 1);
 }
 
-void mp_bit_or(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
-               mp_uint *rp)
+// e = sum of a_i 2^(shift (i - first) / 2) over i = first, first + 2, ...
+// where a has k pieces of h limbs except the last which has s limbs
+
+static void mp_toom_eval_part(const mp_uint *ap, mp_size k, mp_size h,
+                              mp_size s, mp_size first, mp_size shift,
+                              mp_uint *ep)
 {
-    MP_EXPECTS(an >= bn);
-    MP_EXPECTS(bn);
+    mp_size i = first + (k - 1 - first) / 2 * 2;
+    mp_size n = i == k - 1 ? s : h;
 
-    mp_bit_or_n(ap, bp, bn, rp);
-    mp_uint_move(ap + bn, an - bn, rp + bn);
+    mp_uint_copy(ap + i * h, n, ep);
+    mp_uint_zero(ep + n, h + 1 - n);
+
+    while (i >= first + 2) {
+        i -= 2;
+
+        if (shift) {
+            mp_left_shift(ep, h + 1, shift, ep);
+        }
+
+        mp_add(ep, h + 1, ap + i * h, h, ep);
+    }
 }
 
-void mp_bit_xor_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+// e1 = a(1), em1 = |a(-1)|, returns whether a(-1) < 0
+
+static mp_bool mp_toom_eval_pm1(const mp_uint *ap, mp_size k, mp_size h,
+                                mp_size s, mp_uint *e1p, mp_uint *em1p,
+                                mp_uint *tp)
 {
-    MP_EXPECTS(n);
+    mp_toom_eval_part(ap, k, h, s, 0, 0, e1p);
+    mp_toom_eval_part(ap, k, h, s, 1, 0, tp);
 
-    do {
-        *rp++ = *ap++ ^ *bp++;
-    } while (--n);
+    mp_bool neg = mp_sub_abs(e1p, h + 1, tp, h + 1, em1p);
+    mp_add_n(e1p, tp, h + 1, e1p);
+
+    return neg;
 }
 
-void mp_bit_xor(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
-                mp_uint *rp)
+// e = |a(-2)|, returns whether a(-2) < 0
+
+static mp_bool mp_toom_eval_m2(const mp_uint *ap, mp_size k, mp_size h,
+                               mp_size s, mp_uint *ep, mp_uint *tp)
 {
-    MP_EXPECTS(an >= bn);
-    MP_EXPECTS(bn);
+    mp_toom_eval_part(ap, k, h, s, 0, 2, ep);
+    mp_toom_eval_part(ap, k, h, s, 1, 2, tp);
+    mp_left_shift(tp, h + 1, 1, tp);
 
-    mp_bit_xor_n(ap, bp, bn, rp);
-    mp_uint_move(ap + bn, an - bn, rp + bn);
+    return mp_sub_abs(ep, h + 1, tp, h + 1, ep);
 }
 
-void mp_bit_not(const mp_uint *ap, mp_size an, mp_uint *rp)
+// Bodrato's interpolation sequence for the points 0, 1, -1, -2 and infinity.
+// The values r1, rm1 and rm2 are l limb two's complement, r0 and rinf are
+// nonnegative. On return r1, rm1 and rm2 hold the coefficients of B^h, B^2h
+// and B^3h respectively.
+
+static void mp_toom_interpolate_5pt(mp_uint *r1, mp_uint *rm1, mp_uint *rm2,
+                                    mp_size l, const mp_uint *r0, mp_size r0n,
+                                    const mp_uint *rinf, mp_size rinfn)
 {
-    MP_EXPECTS(an);
+    // r3 = (r(-2) - r(1)) / 3
+    mp_sub_n(rm2, r1, l, rm2);
+    mp_divexact_by3(rm2, l);
 
-    do {
-        *rp++ = ~*ap++;
-    } while (--an);
+    // r1 = (r(1) - r(-1)) / 2
+    mp_sub_n(r1, rm1, l, r1);
+    mp_divexact_by2_signed(r1, l);
+
+    // r2 = r(-1) - r(0)
+    mp_sub(rm1, l, r0, r0n, rm1);
+
+    // r3 = (r2 - r3) / 2 + 2 r(inf)
+    mp_sub_n(rm1, rm2, l, rm2);
+    mp_divexact_by2_signed(rm2, l);
+    mp_add(rm2, l, rinf, rinfn, rm2);
+    mp_add(rm2, l, rinf, rinfn, rm2);
+
+    // r2 = r2 + r1 - r(inf)
+    mp_add_n(rm1, r1, l, rm1);
+    mp_sub(rm1, l, rinf, rinfn, rm1);
+
+    // r1 = r1 - r3
+    mp_sub_n(r1, rm2, l, r1);
 }
 
-// -a = ~(a - 1)
+// Multiplies a split into ka pieces by b split into kb pieces of h limbs,
+// where ka + kb = 6, through the points 0, 1, -1, -2 and infinity.
 
-mp_uint mp_negate(const mp_uint *ap, mp_size an, mp_uint *rp)
+static void mp_mul_toom_5pt(const mp_uint *ap, mp_size an, mp_size ka,
+                            const mp_uint *bp, mp_size bn, mp_size kb,
+                            mp_size h, mp_uint *rp, mp_uint *tp)
 {
-    MP_EXPECTS(an);
+    mp_size s = an - (ka - 1) * h;
+    mp_size t = bn - (kb - 1) * h;
+    mp_size n = h + 1;
+    mp_size l = 2 * n;
+
+    MP_EXPECTS(ka + kb == 6);
+    MP_EXPECTS(s && s <= h);
+    MP_EXPECTS(t && t <= h);
+
+    mp_uint *r1 = tp;
+    mp_uint *rm1 = tp + l;
+    mp_uint *rm2 = tp + 2 * l;
+    mp_uint *e0 = tp + 3 * l;
+    mp_uint *e1 = e0 + n;
+    mp_uint *e2 = e1 + n;
+    mp_uint *sp = e2 + n;
+    mp_uint *r0 = rp;
+    mp_uint *rinf = rp + 4 * h;
+    mp_bool neg;
+
+    neg = mp_toom_eval_pm1(ap, ka, h, s, rm2, rm2 + n, e0) ^
+          mp_toom_eval_pm1(bp, kb, h, t, e1, e2, e0);
+    mp_mul_rec(rm2, n, e1, n, r1, sp);
+    mp_mul_rec(rm2 + n, n, e2, n, rm1, sp);
+
+    if (neg) {
+        mp_negate(rm1, l, rm1);
+    }
 
-    mp_uint c = 1;
-    do {
-        mp_uint a = *ap++;
-        mp_uint r = ~(a - c);
+    neg = mp_toom_eval_m2(ap, ka, h, s, e1, e0) ^
+          mp_toom_eval_m2(bp, kb, h, t, e2, e0);
+    mp_mul_rec(e1, n, e2, n, rm2, sp);
 
-        c = a < c;
-        *rp++ = r;
-    } while (--an);
-    return c;
+    if (neg) {
+        mp_negate(rm2, l, rm2);
+    }
+
+    mp_mul_rec(ap, h, bp, h, r0, sp);
+    mp_mul_rec(ap + (ka - 1) * h, s, bp + (kb - 1) * h, t, rinf, sp);
+    mp_uint_zero(rp + 2 * h, 2 * h);
+    mp_toom_interpolate_5pt(r1, rm1, rm2, l, r0, 2 * h, rinf, s + t);
+
+    mp_add_clipped(rp + h, an + bn - h, r1, l);
+    mp_add_clipped(rp + 2 * h, an + bn - 2 * h, rm1, l);
+    mp_add_clipped(rp + 3 * h, an + bn - 3 * h, rm2, l);
 }
 
-mp_bool mp_equal_n(const mp_uint *ap, const mp_uint *bp, mp_size n)
-{
-    MP_EXPECTS(n);
+// a = a2 B^2h + a1 B^h + a0
+// b = b2 B^2h + b1 B^h + b0
 
-    return !memcmp(ap, bp, sizeof(mp_uint) * n);
+static void mp_mul_toom3(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                         mp_size bn, mp_uint *rp, mp_uint *tp)
+{
+    mp_mul_toom_5pt(ap, an, 3, bp, bn, 3, (an + 2) / 3, rp, tp);
 }
 
-mp_bool mp_equal(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn)
+// a = a3 B^3h + a2 B^2h + a1 B^h + a0
+// b = b1 B^h + b0
+
+static void mp_mul_toom42(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                          mp_size bn, mp_uint *rp, mp_uint *tp)
 {
-    MP_EXPECTS(an);
-    MP_EXPECTS(bn);
+    mp_size h = (an + 3) / 4 > (bn + 1) / 2 ? (an + 3) / 4 : (bn + 1) / 2;
 
-    return an == bn && mp_equal_n(ap, bp, bn);
+    mp_mul_toom_5pt(ap, an, 4, bp, bn, 2, h, rp, tp);
 }
 
-int mp_cmp_n(const mp_uint *ap, const mp_uint *bp, mp_size n)
+// a = a2 B^2h + a1 B^h + a0
+// b = b1 B^h + b0
+// c2 = (r(1) + r(-1)) / 2 - r(0)
+// c1 = (r(1) - r(-1)) / 2 - r(inf)
+
+static void mp_mul_toom32(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                          mp_size bn, mp_uint *rp, mp_uint *tp)
 {
-    MP_EXPECTS(n);
+    mp_size h = (an + 2) / 3 > (bn + 1) / 2 ? (an + 2) / 3 : (bn + 1) / 2;
+    mp_size s = an - 2 * h;
+    mp_size t = bn - h;
+    mp_size n = h + 1;
+    mp_size l = 2 * n;
+
+    MP_EXPECTS(s && s <= h);
+    MP_EXPECTS(t && t <= h);
+
+    mp_uint *r1 = tp;
+    mp_uint *rm1 = tp + l;
+    mp_uint *ea1 = tp + 2 * l;
+    mp_uint *eam1 = ea1 + n;
+    mp_uint *eb1 = eam1 + n;
+    mp_uint *ebm1 = eb1 + n;
+    mp_uint *e = ebm1 + n;
+    mp_uint *sp = e + n;
+    mp_uint *r0 = rp;
+    mp_uint *rinf = rp + 3 * h;
+    mp_bool neg;
+
+    neg = mp_toom_eval_pm1(ap, 3, h, s, ea1, eam1, e) ^
+          mp_toom_eval_pm1(bp, 2, h, t, eb1, ebm1, e);
+    mp_mul_rec(ea1, n, eb1, n, r1, sp);
+    mp_mul_rec(eam1, n, ebm1, n, rm1, sp);
+
+    if (neg) {
+        mp_negate(rm1, l, rm1);
+    }
 
-    do {
-        mp_uint a = ap[--n];
-        mp_uint b = bp[n];
+    mp_mul_rec(ap, h, bp, h, r0, sp);
+    mp_mul_rec(ap + 2 * h, s, bp + h, t, rinf, sp);
+    mp_uint_zero(rp + 2 * h, h);
 
-        if (a > b) {
-            return 1;
-        } else if (a < b) {
-            return -1;
-        }
-    } while (n);
+    mp_add_n(r1, rm1, l, rm1);
+    mp_divexact_by2_signed(rm1, l);
+    mp_sub_n(r1, rm1, l, r1);
+    mp_sub(rm1, l, r0, 2 * h, rm1);
+    mp_sub(r1, l, rinf, s + t, r1);
 
-    return 0;
+    mp_add_clipped(rp + h, an + bn - h, r1, l);
+    mp_add_clipped(rp + 2 * h, an + bn - 2 * h, rm1, l);
 }
 
-int mp_cmp(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn)
+// Splits a into bn limb blocks and accumulates the balanced products.
+
+static void mp_mul_unbalanced(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                              mp_size bn, mp_uint *rp, mp_uint *tp)
 {
-    MP_EXPECTS(an);
-    MP_EXPECTS(bn);
+    mp_uint *sp = tp + 2 * bn;
 
-    return an == bn ? mp_cmp_n(ap, bp, an) : an > bn ? 1 : an < bn ? -1 : 0;
+    mp_mul_rec(ap, bn, bp, bn, rp, sp);
+
+    for (mp_size i = bn; i < an; i += bn) {
+        mp_size m = an - i < bn ? an - i : bn;
+        mp_uint c;
+
+        mp_mul_rec(ap + i, m, bp, bn, tp, sp);
+        c = mp_add_n(rp + i, tp, bn, rp + i);
+        mp_uint_copy(tp + bn, m, rp + i + bn);
+        mp_add_uint(rp + i + bn, m, c, rp + i + bn);
+    }
 }
 
-int mp_cmp_uint(const mp_uint *ap, mp_size an, mp_uint b)
+static void mp_mul_rec(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                       mp_size bn, mp_uint *rp, mp_uint *tp)
 {
-    MP_EXPECTS(an);
+    if (an < bn) {
+        mp_mul_rec(bp, bn, ap, an, rp, tp);
+    } else if (bn < MP_MUL_KARATSUBA_THRESHOLD) {
+        mp_mul_basecase(ap, an, bp, bn, rp);
+    } else if (4 * an < 5 * bn) {
+        if (bn >= MP_MUL_TOOM3_THRESHOLD) {
+            mp_mul_toom3(ap, an, bp, bn, rp, tp);
+        } else {
+            mp_mul_karatsuba(ap, an, bp, bn, rp, tp);
+        }
+    } else if (4 * an < 7 * bn) {
+        mp_mul_toom32(ap, an, bp, bn, rp, tp);
+    } else if (2 * an < 5 * bn) {
+        mp_mul_toom42(ap, an, bp, bn, rp, tp);
+    } else {
+        mp_mul_unbalanced(ap, an, bp, bn, rp, tp);
+    }
+}
 
-    return mp_cmp(ap, an, &b, 1);
+// Bounds the scratch used by mp_mul_rec and mp_sqr_rec. Every level needs at
+// most 4n + 32 limbs and recurses on operands of at most n / 2 + 1 limbs.
+
+static mp_size mp_mul_scratch_size(mp_size an, mp_size threshold)
+{
+    _Static_assert(MP_MUL_KARATSUBA_THRESHOLD >= 8, "threshold too small");
+    _Static_assert(MP_SQR_KARATSUBA_THRESHOLD >= 8, "threshold too small");
+
+    mp_size size = 0;
+
+    while (an >= threshold) {
+        size += 4 * an + 32;
+        an = an / 2 + 1;
+    }
+
+    return size;
 }
 
-mp_size mp_has_single_bit(const mp_uint *ap, mp_size an)
+mp_uint mp_mul_with_alloc(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                          mp_size bn, mp_uint *rp, struct mp_allocator *alloc)
 {
-    MP_EXPECTS(an);
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
 
-    do {
-        mp_uint a = ap[--an];
+    if (ap == bp && an == bn) {
+        return mp_sqr_with_alloc(ap, an, rp, alloc);
+    }
 
-        if (a) {
-            if (!mp_uint_has_single_bit(a)) {
-                return mp_false;
-            }
+    if (bn >= MP_MUL_NTT_THRESHOLD &&
+        mp_get_mul_backend() == MP_MUL_BACKEND_NTT &&
+        !mp_mul_ntt(ap, an, bp, bn, rp, alloc)) {
+        return rp[an + bn - 1];
+    }
 
-            while (an) {
-                if (ap[--an]) {
-                    return mp_false;
-                }
-            }
+    if (bn >= MP_MUL_FFT_THRESHOLD && !mp_mul_fft(ap, an, bp, bn, rp, alloc)) {
+        return rp[an + bn - 1];
+    }
 
-            return mp_true;
+    if (bn >= MP_MUL_KARATSUBA_THRESHOLD) {
+        mp_size tn = mp_mul_scratch_size(an, MP_MUL_KARATSUBA_THRESHOLD);
+        mp_uint *tp = mp_allocate_uint(alloc, tn);
+
+        if (tp) {
+            mp_mul_rec(ap, an, bp, bn, rp, tp);
+            mp_deallocate_uint(alloc, tp, tn);
+            return rp[an + bn - 1];
         }
-    } while (an);
+    }
 
-    return mp_false;
+    mp_mul_basecase(ap, an, bp, bn, rp);
+    return rp[an + bn - 1];
 }
 
-mp_size mp_countl_zero(const mp_uint *ap, mp_size an)
+// r = sum of a_i^2 B^2i + 2 sum of a_i a_j B^(i + j), i < j
+
+static void mp_sqr_basecase(const mp_uint *ap, mp_size an, mp_uint *rp)
 {
     MP_EXPECTS(an);
 
-    mp_size n = an;
-    do {
-        mp_uint a = ap[--n];
+    mp_uint c = 0;
 
-        if (a) {
-            return mp_uint_countl_zero(a) + MP_UINT_WIDTH + (an - n + 1);
+    rp[0] = 0;
+    rp[2 * an - 1] = 0;
+
+    if (an > 1) {
+        rp[an] = mp_mul_uint(ap + 1, an - 1, ap[0], rp + 1);
+
+        for (mp_size i = 1; i + 1 < an; i++) {
+            rp[an + i] = mp_addmul_uint(
+                ap + i + 1, an - i - 1, ap[i], rp + 2 * i + 1);
         }
-    } while (n);
-    return MP_UINT_WIDTH * an;
+
+        mp_left_shift(rp, 2 * an, 1, rp);
+    }
+
+    for (mp_size i = 0; i < an; i++) {
+        mp_uint hi, lo = mp_uint_mul(ap[i], ap[i], &hi);
+        mp_uint r0 = rp[2 * i];
+        mp_uint r1 = rp[2 * i + 1];
+
+        lo += c;
+        hi += lo < c;
+        r0 += lo;
+        hi += r0 < lo;
+        r1 += hi;
+        c = r1 < hi;
+
+        rp[2 * i] = r0;
+        rp[2 * i + 1] = r1;
+    }
+
+    MP_ENSURES(!c);
 }
 
-mp_size mp_countl_one(const mp_uint *ap, mp_size an)
+static void mp_sqr_rec(const mp_uint *ap, mp_size an, mp_uint *rp,
+                       mp_uint *tp);
+
+// a = a1 B^h + a0
+// a^2 = a1^2 B^2h + (a0^2 + a1^2 - (a0 - a1)^2) B^h + a0^2
+
+static void mp_sqr_karatsuba(const mp_uint *ap, mp_size an, mp_uint *rp,
+                             mp_uint *tp)
 {
-    MP_EXPECTS(an);
+    mp_size h = (an + 1) / 2;
+    mp_size s = an - h;
 
-    mp_size n = an;
-    do {
-        mp_uint a = ap[--n];
+    mp_uint *da = tp;
+    mp_uint *zm = tp + 2 * h + 1;
+    mp_uint *sp = tp + 4 * h + 1;
+    mp_uint *w = tp;
 
-        if (~a) {
-            return mp_uint_countl_one(a) + MP_UINT_WIDTH + (an - n + 1);
-        }
-    } while (n);
-    return MP_UINT_WIDTH * an;
+    mp_sub_abs(ap, h, ap + h, s, da);
+    mp_sqr_rec(da, h, zm, sp);
+    mp_sqr_rec(ap, h, rp, sp);
+    mp_sqr_rec(ap + h, s, rp + 2 * h, sp);
+
+    w[2 * h] = mp_add(rp, 2 * h, rp + 2 * h, 2 * s, w);
+    mp_sub(w, 2 * h + 1, zm, 2 * h, w);
+
+    mp_add_clipped(rp + h, 2 * an - h, w, 2 * h + 1);
 }
 
-mp_size mp_countr_zero(const mp_uint *ap, mp_size an)
+// a = a2 B^2h + a1 B^h + a0, squared through the points 0, 1, -1, -2 and
+// infinity. The values at the points are squares, so no signs are tracked.
+
+static void mp_sqr_toom3(const mp_uint *ap, mp_size an, mp_uint *rp,
+                         mp_uint *tp)
+{
+    mp_size h = (an + 2) / 3;
+    mp_size s = an - 2 * h;
+    mp_size n = h + 1;
+    mp_size l = 2 * n;
+
+    MP_EXPECTS(s && s <= h);
+
+    mp_uint *r1 = tp;
+    mp_uint *rm1 = tp + l;
+    mp_uint *rm2 = tp + 2 * l;
+    mp_uint *e0 = tp + 3 * l;
+    mp_uint *e1 = e0 + n;
+    mp_uint *e2 = e1 + n;
+    mp_uint *sp = e2 + n;
+    mp_uint *r0 = rp;
+    mp_uint *rinf = rp + 4 * h;
+
+    mp_toom_eval_pm1(ap, 3, h, s, e1, e2, e0);
+    mp_sqr_rec(e1, n, r1, sp);
+    mp_sqr_rec(e2, n, rm1, sp);
+
+    mp_toom_eval_m2(ap, 3, h, s, e1, e0);
+    mp_sqr_rec(e1, n, rm2, sp);
+
+    mp_sqr_rec(ap, h, r0, sp);
+    mp_sqr_rec(ap + 2 * h, s, rinf, sp);
+    mp_uint_zero(rp + 2 * h, 2 * h);
+    mp_toom_interpolate_5pt(r1, rm1, rm2, l, r0, 2 * h, rinf, 2 * s);
+
+    mp_add_clipped(rp + h, 2 * an - h, r1, l);
+    mp_add_clipped(rp + 2 * h, 2 * an - 2 * h, rm1, l);
+    mp_add_clipped(rp + 3 * h, 2 * an - 3 * h, rm2, l);
+}
+
+static void mp_sqr_rec(const mp_uint *ap, mp_size an, mp_uint *rp,
+                       mp_uint *tp)
+{
+    if (an < MP_SQR_KARATSUBA_THRESHOLD) {
+        mp_sqr_basecase(ap, an, rp);
+    } else if (an < MP_SQR_TOOM3_THRESHOLD) {
+        mp_sqr_karatsuba(ap, an, rp, tp);
+    } else {
+        mp_sqr_toom3(ap, an, rp, tp);
+    }
+}
+
+mp_uint mp_sqr_with_alloc(const mp_uint *ap, mp_size an, mp_uint *rp,
+                          struct mp_allocator *alloc)
 {
     MP_EXPECTS(an);
 
-    mp_size n = 0;
-    do {
-        mp_uint a = ap[n];
+    if (an >= MP_MUL_NTT_THRESHOLD &&
+        mp_get_mul_backend() == MP_MUL_BACKEND_NTT &&
+        !mp_mul_ntt(ap, an, ap, an, rp, alloc)) {
+        return rp[2 * an - 1];
+    }
 
-        if (a) {
-            return mp_uint_countr_zero(a) + MP_UINT_WIDTH * n;
+    if (an >= MP_MUL_FFT_THRESHOLD && !mp_mul_fft(ap, an, ap, an, rp, alloc)) {
+        return rp[2 * an - 1];
+    }
+
+    if (an >= MP_SQR_KARATSUBA_THRESHOLD) {
+        mp_size tn = mp_mul_scratch_size(an, MP_SQR_KARATSUBA_THRESHOLD);
+        mp_uint *tp = mp_allocate_uint(alloc, tn);
+
+        if (tp) {
+            mp_sqr_rec(ap, an, rp, tp);
+            mp_deallocate_uint(alloc, tp, tn);
+            return rp[2 * an - 1];
         }
-    } while (++n != an);
-    return MP_UINT_WIDTH * an;
+    }
+
+    mp_sqr_basecase(ap, an, rp);
+    return rp[2 * an - 1];
 }
 
-mp_size mp_countr_one(const mp_uint *ap, mp_size an)
+static _Atomic enum mp_mul_backend mp_mul_backend_value = MP_MUL_BACKEND_SSA;
+
+enum mp_mul_backend mp_get_mul_backend(void)
+{
+    return atomic_load(&mp_mul_backend_value);
+}
+
+enum mp_mul_backend mp_set_mul_backend(enum mp_mul_backend backend)
+{
+    return atomic_exchange(&mp_mul_backend_value, backend);
+}
+
+mp_uint mp_mul(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
+               mp_uint *rp)
+{
+    return mp_mul_with_alloc(ap, an, bp, bn, rp, mp_get_default_allocator());
+}
+
+mp_uint mp_sqr(const mp_uint *ap, mp_size an, mp_uint *rp)
+{
+    return mp_sqr_with_alloc(ap, an, rp, mp_get_default_allocator());
+}
+
+enum mp_errc mp_mul_prepare(struct mp_mul_prepared *prep, const mp_uint *bp,
+                            mp_size bn, struct mp_allocator *alloc)
+{
+    MP_EXPECTS(bn);
+
+    prep->_bp = bp;
+    prep->_bn = bn;
+    prep->_data = NULL;
+    prep->_size = 0;
+    prep->_alloc = alloc ? alloc : mp_get_default_allocator();
+
+    if (bn < MP_MUL_PREPARED_THRESHOLD) {
+        return MP_ERRC_OK;
+    }
+
+    mp_size size = mp_ntt_prepared_size(bn);
+
+    if (!size) {
+        return MP_ERRC_OK;
+    }
+
+    prep->_data = mp_allocate_uint(prep->_alloc, size);
+
+    if (!prep->_data) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    prep->_size = size;
+    mp_ntt_prepare(bp, bn, prep->_data);
+
+    return MP_ERRC_OK;
+}
+
+void mp_mul_prepared_destruct(struct mp_mul_prepared *prep)
+{
+    if (prep->_data) {
+        mp_deallocate_uint(prep->_alloc, prep->_data, prep->_size);
+    }
+
+    prep->_data = NULL;
+    prep->_size = 0;
+}
+
+mp_uint mp_mul_prepared(const mp_uint *ap, mp_size an,
+                        const struct mp_mul_prepared *prep, mp_uint *rp)
 {
     MP_EXPECTS(an);
 
-    mp_size n = 0;
-    do {
-        mp_uint a = ap[n];
+    const mp_uint *bp = prep->_bp;
+    mp_size bn = prep->_bn;
 
-        if (~a) {
-            return mp_uint_countr_one(a) + MP_UINT_WIDTH * n;
+    if (prep->_data && an >= MP_MUL_PREPARED_THRESHOLD &&
+        !mp_mul_ntt_prepared(ap, an, bn, prep->_data, rp, prep->_alloc)) {
+        return rp[an + bn - 1];
+    }
+
+    if (an >= bn) {
+        return mp_mul_with_alloc(ap, an, bp, bn, rp, prep->_alloc);
+    } else {
+        return mp_mul_with_alloc(bp, bn, ap, an, rp, prep->_alloc);
+    }
+}
+
+// r = a b mod B^n
+
+static void mp_mullo_basecase(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    mp_mul_uint(ap, n, bp[0], rp);
+
+    for (mp_size j = 1; j < n; j++) {
+        mp_addmul_uint(ap, n - j, bp[j], rp + j);
+    }
+}
+
+// Drops the columns i + j < n - 1 of the product and the carries out of them,
+// so r <= floor(a b / B^n) <= r + n - 1.
+
+static void mp_mulhi_basecase(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    mp_uint c0 = 0, c1 = 0, c2 = 0;
+
+    // column n - 1
+    for (mp_size j = 0; j < n; j++) {
+        mp_uint hi, lo = mp_uint_mul(ap[n - 1 - j], bp[j], &hi);
+
+        c0 += lo;
+        hi += c0 < lo;
+        c1 += hi;
+        c2 += c1 < hi;
+    }
+
+    rp[0] = c1;
+
+    if (n > 1) {
+        rp[1] = c2;
+        mp_uint_zero(rp + 2, n - 2);
+
+        for (mp_size j = 1; j < n; j++) {
+            mp_uint c = mp_addmul_uint(ap + n - j, j, bp[j], rp);
+
+            mp_add_uint(rp + j, n - j, c, rp + j);
         }
-    } while (++n != an);
-    return MP_UINT_WIDTH * an;
+    }
 }
 
-mp_size mp_bit_width(const mp_uint *ap, mp_size an)
+// Both short products split a and b at l = (n - 1) / 3 limbs, so that the full
+// product of the h = n - l limb parts covers all but two thin strips, which
+// are short products of l limbs.
+
+static mp_size mp_mul_short_scratch_size(mp_size n, mp_size threshold)
 {
-    MP_EXPECTS(an);
+    if (n < threshold) {
+        return 0;
+    }
 
-    return an * MP_UINT_WIDTH - mp_countl_zero(ap, an);
+    mp_size l = (n - 1) / 3;
+    mp_size h = n - l;
+    mp_size full = mp_mul_scratch_size(h, MP_MUL_KARATSUBA_THRESHOLD);
+    mp_size part = l + mp_mul_short_scratch_size(l, threshold);
+
+    return 2 * h + (full > part ? full : part);
 }
 
-mp_size mp_popcount(const mp_uint *ap, mp_size an)
+// a = a1 B^h + a0
+// b = b1 B^h + b0
+// a b mod B^n = a0 b0 + (a1 b0 + a0 b1 mod B^l) B^h
+
+static void mp_mullo_rec(const mp_uint *ap, const mp_uint *bp, mp_size n,
+                         mp_uint *rp, mp_uint *tp)
 {
-    MP_EXPECTS(an);
+    if (n < MP_MULLO_THRESHOLD) {
+        mp_mullo_basecase(ap, bp, n, rp);
+        return;
+    }
 
-    mp_size count = 0;
-    do {
-        count += mp_uint_popcount(ap[--an]);
-    } while (an);
-    return count;
+    mp_size l = (n - 1) / 3;
+    mp_size h = n - l;
+
+    mp_mul_rec(ap, h, bp, h, tp, tp + 2 * h);
+    mp_uint_copy(tp, n, rp);
+
+    mp_mullo_rec(ap + h, bp, l, tp, tp + l);
+    mp_add_n(rp + h, tp, l, rp + h);
+    mp_mullo_rec(ap, bp + h, l, tp, tp + l);
+    mp_add_n(rp + h, tp, l, rp + h);
 }
 
-static mp_size mp_to_bytes_le(const mp_uint *ap, mp_size an, mp_byte *bytes);
+// a = a1 B^l + a0
+// b = b1 B^l + b0
+// a b / B^n ~ a1 b1 / B^(h - l) + a1' b0 / B^l + a0 b1' / B^l
+//
+// where a1' and b1' are the top l limbs of a and b. Every term is truncated,
+// and the terms left out all lie in the columns below n - 1, so if the short
+// products of l limbs are within 3l, then r <= floor(a b / B^n) <= r + 3n.
+
+static void mp_mulhi_rec(const mp_uint *ap, const mp_uint *bp, mp_size n,
+                         mp_uint *rp, mp_uint *tp)
+{
+    if (n < MP_MULHI_THRESHOLD) {
+        mp_mulhi_basecase(ap, bp, n, rp);
+        return;
+    }
+
+    mp_size l = (n - 1) / 3;
+    mp_size h = n - l;
 
-static mp_size mp_to_bytes_be(const mp_uint *ap, mp_size an, mp_byte *bytes);
+    mp_mul_rec(ap + l, h, bp + l, h, tp, tp + 2 * h);
+    mp_uint_copy(tp + h - l, n, rp);
 
-mp_size mp_to_bytes(const mp_uint *ap, mp_size an, mp_byte *bytes,
-                    enum mp_endian endian)
+    mp_mulhi_rec(ap + h, bp, l, tp, tp + l);
+    mp_add(rp, n, tp, l, rp);
+    mp_mulhi_rec(ap, bp + h, l, tp, tp + l);
+    mp_add(rp, n, tp, l, rp);
+}
+
+// Above the FFT threshold a short product is no cheaper than the full one,
+// which the transform forms at once, so it is taken from the full product.
+
+static mp_bool mp_mul_short_via_full(const mp_uint *ap, const mp_uint *bp,
+                                     mp_size n, mp_uint *rp, mp_size offset,
+                                     struct mp_allocator *alloc)
 {
-    if (endian == MP_ENDIAN_LITTLE) {
-        return mp_to_bytes_le(ap, an, bytes);
-    } else {
-        return mp_to_bytes_be(ap, an, bytes);
+    mp_uint *tp = mp_allocate_uint(alloc, 2 * n);
+
+    if (!tp) {
+        return mp_false;
     }
+
+    mp_mul_with_alloc(ap, n, bp, n, tp, alloc);
+    mp_uint_copy(tp + offset, n, rp);
+    mp_deallocate_uint(alloc, tp, 2 * n);
+    return mp_true;
 }
 
-mp_size mp_from_bytes(
-    mp_byte *bytes, mp_size byte_count, mp_uint *rp, enum mp_endian endian);
+void mp_mullo_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    MP_EXPECTS(n);
+
+    struct mp_allocator *alloc = mp_get_default_allocator();
 
-static struct mp_to_string_result mp_to_string_zero(char *first, char *last)
+    if (n >= MP_MUL_FFT_THRESHOLD &&
+        mp_mul_short_via_full(ap, bp, n, rp, 0, alloc)) {
+        return;
+    }
+
+    if (n >= MP_MULLO_THRESHOLD) {
+        mp_size tn = mp_mul_short_scratch_size(n, MP_MULLO_THRESHOLD);
+        mp_uint *tp = mp_allocate_uint(alloc, tn);
+
+        if (tp) {
+            mp_mullo_rec(ap, bp, n, rp, tp);
+            mp_deallocate_uint(alloc, tp, tn);
+            return;
+        }
+    }
+
+    mp_mullo_basecase(ap, bp, n, rp);
+}
+
+void mp_mulhi_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
 {
-    if (last - first < 1) {
-        return mp_to_string_no_mem(first);
+    MP_EXPECTS(n);
+
+    struct mp_allocator *alloc = mp_get_default_allocator();
+
+    if (n >= MP_MUL_FFT_THRESHOLD &&
+        mp_mul_short_via_full(ap, bp, n, rp, n, alloc)) {
+        return;
     }
 
-    *first++ = '0';
-    return mp_to_string_ok(first);
+    if (n >= MP_MULHI_THRESHOLD) {
+        mp_size tn = mp_mul_short_scratch_size(n, MP_MULHI_THRESHOLD);
+        mp_uint *tp = mp_allocate_uint(alloc, tn);
+
+        if (tp) {
+            mp_mulhi_rec(ap, bp, n, rp, tp);
+            mp_deallocate_uint(alloc, tp, tn);
+            return;
+        }
+    }
+
+    mp_mulhi_basecase(ap, bp, n, rp);
 }
 
-static struct mp_to_string_result mp_to_string_2(
-    char *first, char *last, const mp_uint *ap, mp_size an)
+// r += sum of a_i b_j B^(i + j - bn + 1) over bn - 1 <= i + j < an. The m =
+// an - bn + 1 columns each add up to less than bn B^2, so the sum takes m + 2
+// limbs. Carries are propagated through all rn >= m + 2 limbs of r.
+
+static void mp_mulmid_basecase(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                               mp_size bn, mp_uint *rp, mp_size rn)
 {
-    mp_size bit_width = mp_bit_width(ap, an);
+    mp_size m = an - bn + 1;
 
-    if (!bit_width) {
-        return mp_to_string_zero(first, last);
-    } else if (last - first < bit_width) {
-        return mp_to_string_no_mem(first);
+    for (mp_size j = 0; j < bn; j++) {
+        mp_uint c = mp_addmul_uint(ap + bn - 1 - j, m, bp[j], rp);
+
+        mp_add_uint(rp + m, rn - m, c, rp + m);
     }
+}
+
+// c = sum of a_i b_j over i + j = k, j < bn
+
+static void mp_mulmid_column(const mp_uint *ap, const mp_uint *bp, mp_size bn,
+                             mp_size k, mp_uint *cp)
+{
+    mp_uint c0 = 0, c1 = 0, c2 = 0;
 
-    mp_size bit_count = bit_width % MP_UINT_WIDTH;
-    mp_size uint_count = bit_width / MP_UINT_WIDTH;
+    for (mp_size j = 0; j < bn; j++) {
+        mp_uint hi, lo = mp_uint_mul(ap[k - j], bp[j], &hi);
 
-    while (bit_count) {
-        *first++ = '0' + ((ap[uint_count] >> --bit_count) & 1);
+        c0 += lo;
+        hi += c0 < lo;
+        c1 += hi;
+        c2 += c1 < hi;
     }
 
-    while (uint_count) {
-        mp_size pos = MP_UINT_WIDTH;
+    cp[0] = c0;
+    cp[1] = c1;
+    cp[2] = c2;
+}
+
+static void mp_mulmid_rec(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                          mp_size bn, mp_uint *rp, mp_size rn, mp_uint *tp);
+
+static inline void mp_mulmid_acc(mp_uint *cp, mp_uint x)
+{
+    cp[0] += x;
+    cp[1] += cp[0] < x;
+}
+
+// s = a0 + a1 over 2h - 1 limbs. The middle product of the limbwise sum
+// by an h limb b is then MP(s, b) + hi B^h - lo, as every carry out of limb i
+// only moves a product across an edge of the window when i + j = 2h - 2 or
+// i + j = h - 2.
+
+static void mp_mulmid_add_pieces(const mp_uint *a0p, const mp_uint *a1p,
+                                 const mp_uint *bp, mp_size h, mp_uint *sp,
+                                 mp_uint *hip, mp_uint *lop)
+{
+    mp_uint c = 0;
+
+    hip[0] = hip[1] = lop[0] = lop[1] = 0;
+
+    for (mp_size i = 0; i < 2 * h - 1; i++) {
+        mp_uint a = a0p[i];
+        mp_uint b = a1p[i] + c;
+        mp_uint s = a + b;
 
-        while (pos) {
-            *first++ = '0' + ((ap[--uint_count] >> --pos) & 1);
+        c = (b < c) + (s < b);
+        sp[i] = s;
+
+        if (!c) {
+            continue;
+        } else if (i >= h - 1) {
+            mp_mulmid_acc(hip, bp[2 * h - 2 - i]);
+        } else {
+            mp_mulmid_acc(lop, bp[h - 2 - i]);
         }
     }
+}
 
-    return mp_to_string_ok(first);
+// t = b0 - b1 over h limbs, for b0 >= b1. The middle product of an 2h - 1
+// limb a by the limbwise difference is then MP(a, t) - hi B^h + lo.
+
+static void mp_mulmid_sub_pieces(const mp_uint *b0p, const mp_uint *b1p,
+                                 const mp_uint *ap, mp_size h, mp_uint *tp,
+                                 mp_uint *hip, mp_uint *lop)
+{
+    mp_uint c = 0;
+
+    hip[0] = hip[1] = lop[0] = lop[1] = 0;
+
+    for (mp_size j = 0; j < h; j++) {
+        mp_uint a = b0p[j];
+        mp_uint b = b1p[j] + c;
+        mp_uint t = a - b;
+
+        c = (b < c) + (a < b);
+        tp[j] = t;
+
+        if (c && j + 2 <= h) {
+            mp_mulmid_acc(hip, ap[2 * h - 2 - j]);
+            mp_mulmid_acc(lop, ap[h - 2 - j]);
+        }
+    }
 }
 
-static struct mp_to_string_result mp_to_string_8(
-    char *first, char *last, const mp_uint *ap, mp_size an);
+// Hanrot, Quercia and Zimmermann's transposed Karatsuba. For a of 4h - 1
+// limbs cut into overlapping pieces x0, x1, x2 of 2h - 1 limbs at 0, h and 2h,
+// and b = b1 B^h + b0,
+//
+// alpha = MP(x0 + x1, b1)
+// beta = MP(x1, b0 - b1)
+// gamma = MP(x1 + x2, b0)
+// MP(a, b) = alpha + beta + (gamma - beta) B^h
+//
+// Writes the n + 2 limbs of r, n = 2h.
+
+static void mp_mulmid_n(const mp_uint *ap, const mp_uint *bp, mp_size n,
+                        mp_uint *rp, mp_uint *tp)
+{
+    MP_EXPECTS(n % 2 == 0);
+
+    mp_size h = n / 2;
+    mp_size l = h + 2;
+
+    mp_uint *alpha = tp;
+    mp_uint *beta = alpha + l;
+    mp_uint *gamma = beta + l;
+    mp_uint *s = gamma + l;
+    mp_uint *t = s + 2 * h - 1;
+    mp_uint *sp = t + h;
+    const mp_uint *x0 = ap;
+    const mp_uint *x1 = ap + h;
+    const mp_uint *x2 = ap + 2 * h;
+    const mp_uint *b0 = bp;
+    const mp_uint *b1 = bp + h;
+    mp_uint hi[2], lo[2];
+
+    mp_mulmid_add_pieces(x0, x1, b1, h, s, hi, lo);
+    mp_uint_zero(alpha, l);
+    mp_mulmid_rec(s, 2 * h - 1, b1, h, alpha, l, sp);
+    mp_add_n(alpha + h, hi, 2, alpha + h);
+    mp_sub(alpha, l, lo, 2, alpha);
+
+    mp_mulmid_add_pieces(x1, x2, b0, h, s, hi, lo);
+    mp_uint_zero(gamma, l);
+    mp_mulmid_rec(s, 2 * h - 1, b0, h, gamma, l, sp);
+    mp_add_n(gamma + h, hi, 2, gamma + h);
+    mp_sub(gamma, l, lo, 2, gamma);
+
+    // beta is signed, l limbs in two's complement
+    mp_bool neg = mp_cmp_n(b0, b1, h) < 0;
+
+    mp_mulmid_sub_pieces(neg ? b1 : b0, neg ? b0 : b1, x1, h, t, hi, lo);
+    mp_uint_zero(beta, l);
+    mp_mulmid_rec(x1, 2 * h - 1, t, h, beta, l, sp);
+    mp_sub_n(beta + h, hi, 2, beta + h);
+    mp_add(beta, l, lo, 2, beta);
+
+    if (neg) {
+        mp_negate(beta, l, beta);
+    }
 
-static struct mp_to_string_result mp_to_string_10(
-    char *first, char *last, const mp_uint *ap, mp_size an);
+    mp_add_n(alpha, beta, l, alpha);
+    mp_sub_n(gamma, beta, l, gamma);
 
-static struct mp_to_string_result mp_to_string_16(
-    char *first, char *last, const mp_uint *ap, mp_size an);
+    mp_uint_copy(alpha, l, rp);
+    mp_uint_zero(rp + l, h);
+    mp_add_n(rp + h, gamma, l, rp + h);
+}
 
-static struct mp_to_string_result mp_to_string_n(
-    char *first, char *last, const mp_uint *ap, mp_size an, int base);
+// Cuts the product into balanced middle products of an even size, after
+// peeling off a row or a column when the smaller dimension is odd.
 
-struct mp_to_string_result mp_to_string(
-    char *first, char *last, const mp_uint *ap, mp_size an, int base)
+static void mp_mulmid_rec(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                          mp_size bn, mp_uint *rp, mp_size rn, mp_uint *tp)
 {
-    MP_EXPECTS(base >= 2 && base <= 36);
+    mp_size m = an - bn + 1;
+    mp_uint *up = tp;
+
+    if (m < MP_MULMID_THRESHOLD || bn < MP_MULMID_THRESHOLD) {
+        mp_mulmid_basecase(ap, an, bp, bn, rp, rn);
+    } else if (m >= bn && bn % 2) {
+        mp_uint c = mp_addmul_uint(ap + bn - 1, m, bp[0], rp);
+
+        mp_add_uint(rp + m, rn - m, c, rp + m);
+        mp_mulmid_rec(ap, an - 1, bp + 1, bn - 1, rp, rn, tp);
+    } else if (m >= bn) {
+        mp_size k = 0;
+
+        for (; k + bn <= m; k += bn) {
+            mp_mulmid_n(ap + k, bp, bn, up, up + bn + 2);
+            mp_add(rp + k, rn - k, up, bn + 2, rp + k);
+        }
 
-    if (!an) {
-        return mp_to_string_zero(first, last);
+        if (k < m) {
+            mp_mulmid_rec(ap + k, an - k, bp, bn, rp + k, rn - k, tp);
+        }
+    } else if (m % 2) {
+        mp_uint c[3];
+
+        mp_mulmid_column(ap, bp, bn, an - 1, c);
+        mp_add(rp + m - 1, rn - m + 1, c, 3, rp + m - 1);
+        mp_mulmid_rec(ap, an - 1, bp, bn, rp, rn, tp);
+    } else {
+        mp_size j = 0;
+
+        for (; j + m <= bn; j += m) {
+            mp_mulmid_n(ap + bn - j - m, bp + j, m, up, up + m + 2);
+            mp_add(rp, rn, up, m + 2, rp);
+        }
+
+        if (j < bn) {
+            mp_mulmid_rec(ap, m + bn - j - 1, bp + j, bn - j, rp, rn, tp);
+        }
     }
+}
 
-    switch (base) {
-    case 2:
-        return mp_to_string_2(first, last, ap, an);
-    case 8:
-        return mp_to_string_8(first, last, ap, an);
-    case 10:
-        return mp_to_string_10(first, last, ap, an);
-    case 16:
-        return mp_to_string_16(first, last, ap, an);
-    default:
-        return mp_to_string_n(first, last, ap, an, base);
+// Every level takes at most 4n + 8 limbs, n the smaller of m and bn, and
+// recurses on n / 2.
+
+static mp_size mp_mulmid_scratch_size(mp_size n)
+{
+    _Static_assert(MP_MULMID_THRESHOLD >= 4, "threshold too small");
+
+    mp_size size = 0;
+
+    while (n >= MP_MULMID_THRESHOLD) {
+        size += 4 * n + 8;
+        n = n / 2 + 1;
     }
+
+    return size;
 }
 
-static struct mp_from_string_result mp_from_string_2(
-    const char *first, const char *last, mp_uint *ap, mp_size an);
+void mp_mulmid(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
+               mp_uint *rp)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
 
-static struct mp_from_string_result mp_from_string_8(
-    const char *first, const char *last, mp_uint *ap, mp_size an);
+    struct mp_allocator *alloc = mp_get_default_allocator();
+    mp_size m = an - bn + 1;
+    mp_size n = m < bn ? m : bn;
 
-static struct mp_from_string_result mp_from_string_10(
-    const char *first, const char *last, mp_uint *ap, mp_size an);
+    if (n >= MP_MULMID_NTT_THRESHOLD &&
+        !mp_mulmid_ntt(ap, an, bp, bn, rp, alloc)) {
+        return;
+    }
 
-static struct mp_from_string_result mp_from_string_16(
-    const char *first, const char *last, mp_uint *ap, mp_size an);
+    mp_size tn = mp_mulmid_scratch_size(n);
+    mp_uint *tp = tn ? mp_allocate_uint(alloc, tn) : NULL;
 
-static struct mp_from_string_result mp_from_string_n(
-    const char *first, const char *last, mp_uint *ap, mp_size an, int base);
+    mp_uint_zero(rp, m + 2);
+
+    if (tp) {
+        mp_mulmid_rec(ap, an, bp, bn, rp, m + 2, tp);
+        mp_deallocate_uint(alloc, tp, tn);
+    } else {
+        mp_mulmid_basecase(ap, an, bp, bn, rp, m + 2);
+    }
+}
+
+// Divides by the normalized d, reading n as shifted left by shift bits, with v
+// the inverse of d. Leaves the quotient in q unless it is NULL.
+
+static mp_uint mp_div_uint_norm(const mp_uint *np, mp_size nn, mp_uint d,
+                                mp_size shift, mp_uint v, mp_uint *qp)
+{
+    MP_EXPECTS(nn);
+    MP_EXPECTS(d >> (MP_UINT_WIDTH - 1));
+
+    mp_uint r = 0;
+
+    if (!shift) {
+        do {
+            mp_uint q = mp_uint_div_inv(r, np[--nn], d, v, &r);
+
+            if (qp) {
+                qp[nn] = q;
+            }
+        } while (nn);
+
+        return r;
+    }
+
+    mp_size rshift = MP_UINT_WIDTH - shift;
+    mp_uint prev = np[--nn];
+
+    // the bits shifted out of the top limb are below d
+    r = prev >> rshift;
+
+    while (nn) {
+        mp_uint next = np[--nn];
+        mp_uint q = mp_uint_div_inv(
+            r, prev << shift | next >> rshift, d, v, &r);
+
+        if (qp) {
+            qp[nn + 1] = q;
+        }
+
+        prev = next;
+    }
+
+    mp_uint q = mp_uint_div_inv(r, prev << shift, d, v, &r);
+
+    if (qp) {
+        *qp = q;
+    }
+
+    return r >> shift;
+}
+
+mp_uint mp_div_uint(const mp_uint *np, mp_size nn, mp_uint d, mp_uint *qp)
+{
+    MP_EXPECTS(qp);
+    MP_EXPECTS(d);
+
+    mp_size shift = mp_uint_countl_zero(d);
+
+    d <<= shift;
+    return mp_div_uint_norm(np, nn, d, shift, mp_uint_inv(d), qp);
+}
+
+// Knuth's algorithm D for a normalized divisor. Each quotient limb comes from
+// dividing the top three limbs of the partial remainder by the top two of d,
+// which is off by at most one. Leaves the quotient in q, nn - dn limbs plus the
+// returned top limb, and the remainder in the low dn limbs of n.
+
+static mp_uint mp_div_basecase(mp_uint *np, mp_size nn, const mp_uint *dp,
+                               mp_size dn, mp_uint v, mp_uint *qp)
+{
+    MP_EXPECTS(dn >= 2);
+    MP_EXPECTS(nn >= dn);
+    MP_EXPECTS(dp[dn - 1] >> (MP_UINT_WIDTH - 1));
+
+    mp_uint d1 = dp[dn - 1];
+    mp_uint d0 = dp[dn - 2];
+    mp_uint qh = mp_cmp_n(np + nn - dn, dp, dn) >= 0;
+
+    if (qh) {
+        mp_sub_n(np + nn - dn, dp, dn, np + nn - dn);
+    }
+
+    for (mp_size i = nn - dn; i--;) {
+        mp_uint *wp = np + i;
+        mp_uint n2 = wp[dn];
+        mp_uint n1 = wp[dn - 1];
+        mp_uint q;
+
+        if (n2 == d1 && n1 == d0) {
+            q = MP_UINT_MAX;
+            wp[dn] -= mp_submul_uint(dp, dn, q, wp);
+            MP_ENSURES(!wp[dn]);
+        } else {
+            mp_uint r1, r0, c = 0, b;
+
+            q = mp_uint_div_3by2(n2, n1, wp[dn - 2], d1, d0, v, &r1, &r0);
+
+            if (dn > 2) {
+                c = mp_submul_uint(dp, dn - 2, q, wp);
+            }
+
+            b = r0 < c;
+            r0 -= c;
+            c = r1 < b;
+            r1 -= b;
+            wp[dn - 2] = r0;
+            wp[dn - 1] = r1;
+
+            if (c) {
+                --q;
+                mp_add_n(wp, dp, dn, wp);
+            }
+
+            wp[dn] = 0;
+        }
+
+        qp[i] = q;
+    }
+
+    return qh;
+}
+
+// Burnikel–Ziegler. Divides the 2n limbs of n by the n limbs of d: the top
+// half of the quotient comes from dividing by the top half of d, corrected by
+// subtracting its product with the low half, and likewise for the bottom half.
+// The scratch t takes n limbs.
+
+static mp_uint mp_div_dc_n(mp_uint *np, const mp_uint *dp, mp_size n,
+                           mp_uint v, mp_uint *qp, mp_uint *tp,
+                           struct mp_allocator *alloc)
+{
+    _Static_assert(MP_DIV_DC_THRESHOLD >= 4, "threshold too small");
+
+    if (n < MP_DIV_DC_THRESHOLD) {
+        return mp_div_basecase(np, 2 * n, dp, n, v, qp);
+    }
+
+    mp_size lo = n / 2;
+    mp_size hi = n - lo;
+    mp_uint qh, c;
+
+    qh = mp_div_dc_n(np + 2 * lo, dp + lo, hi, v, qp + lo, tp, alloc);
+    mp_mul_with_alloc(qp + lo, hi, dp, lo, tp, alloc);
+    c = mp_sub_n(np + lo, tp, n, np + lo);
+
+    if (qh) {
+        c += mp_sub_n(np + n, dp, lo, np + n);
+    }
+
+    while (c) {
+        qh -= mp_sub_uint(qp + lo, hi, 1, qp + lo);
+        c -= mp_add_n(np + lo, dp, n, np + lo);
+    }
+
+    c = mp_div_dc_n(np + hi, dp + hi, lo, v, qp, tp, alloc);
+    mp_mul_with_alloc(dp, hi, qp, lo, tp, alloc);
+
+    if (c) {
+        c = mp_sub_n(np + lo, dp, hi, np + lo);
+    }
+
+    c += mp_sub_n(np, tp, n, np);
+
+    while (c) {
+        mp_sub_uint(qp, lo, 1, qp);
+        c -= mp_add_n(np, dp, n, np);
+    }
+
+    return qh;
+}
+
+// Divides the top b + dn limbs of n, b <= dn, by the top t = max(b, 2) limbs of
+// d and corrects the quotient against the rest of d
+
+static mp_uint mp_div_dc_top(mp_uint *np, mp_size b, const mp_uint *dp,
+                             mp_size dn, mp_uint v, mp_uint *qp, mp_uint *tp,
+                             struct mp_allocator *alloc)
+{
+    if (b == dn) {
+        return mp_div_dc_n(np, dp, dn, v, qp, tp, alloc);
+    } else if (dn < MP_DIV_DC_THRESHOLD) {
+        return mp_div_basecase(np, b + dn, dp, dn, v, qp);
+    }
+
+    mp_size t = b >= 2 ? b : 2;
+    mp_size ln = dn - t;
+    mp_uint qh, c;
+
+    if (t >= MP_DIV_DC_THRESHOLD) {
+        qh = mp_div_dc_n(np + ln, dp + ln, t, v, qp, tp, alloc);
+    } else {
+        qh = mp_div_basecase(np + ln, b + t, dp + ln, t, v, qp);
+    }
+
+    if (ln >= b) {
+        mp_mul_with_alloc(dp, ln, qp, b, tp, alloc);
+    } else {
+        mp_mul_with_alloc(qp, b, dp, ln, tp, alloc);
+    }
+
+    c = mp_sub(np, dn, tp, b + ln, np);
+
+    if (qh) {
+        c += mp_sub(np + b, dn - b, dp, ln, np + b);
+    }
+
+    while (c) {
+        qh -= mp_sub_uint(qp, b, 1, qp);
+        c -= mp_add_n(np, dp, dn, np);
+    }
+
+    return qh;
+}
+
+// Divides by a normalized divisor one block of dn quotient limbs at a time,
+// starting with the partial block at the top. The scratch t takes dn limbs.
+
+static mp_uint mp_div_dc(mp_uint *np, mp_size nn, const mp_uint *dp,
+                         mp_size dn, mp_uint v, mp_uint *qp, mp_uint *tp,
+                         struct mp_allocator *alloc)
+{
+    MP_EXPECTS(dn >= MP_DIV_DC_THRESHOLD);
+    MP_EXPECTS(nn > dn);
+
+    mp_size qn = nn - dn;
+    mp_size b = qn % dn ? qn % dn : dn;
+    mp_size i = qn - b;
+    mp_uint qh = mp_div_dc_top(np + i, b, dp, dn, v, qp + i, tp, alloc);
+
+    while (i) {
+        i -= dn;
+        mp_div_dc_n(np + i, dp, dn, v, qp + i, tp, alloc);
+    }
+
+    return qh;
+}
+
+// r = floor((B^2n - 1) / a) - B^n for a normalized a, by dividing
+// B^2n - 1 - a B^n. The scratch t takes 3n limbs.
+
+static void mp_invert_basecase(const mp_uint *ap, mp_size n, mp_uint *rp,
+                               mp_uint *tp, struct mp_allocator *alloc)
+{
+    if (n == 1) {
+        *rp = mp_uint_inv(*ap);
+        return;
+    }
+
+    mp_uint v = mp_uint_inv_3by2(ap[n - 1], ap[n - 2]);
+
+    mp_uint_fill(tp, n, MP_UINT_MAX);
+    mp_bit_not(ap, n, tp + n);
+
+    if (n >= MP_DIV_DC_THRESHOLD) {
+        mp_div_dc_n(tp, ap, n, v, rp, tp + 2 * n, alloc);
+    } else {
+        mp_div_basecase(tp, 2 * n, ap, n, v, rp);
+    }
+}
+
+static mp_size mp_invert_scratch_size(mp_size n)
+{
+    if (n < MP_INVERT_THRESHOLD) {
+        return 3 * n;
+    }
+
+    mp_size h = (n + 1) / 2;
+    mp_size rn = mp_invert_scratch_size(h);
+    mp_size ln = 7 * n + 8;
+
+    return h + 1 + (rn > ln ? rn : ln);
+}
+
+// Newton's iteration x' = x + x (B^2n - a x) / B^2n, started from the inverse
+// of the top h limbs of a. The residual B^2n - 1 - a x' follows from the one
+// of the starting point, and is used to step x' to the exact inverse.
+
+static void mp_invert_rec(const mp_uint *ap, mp_size n, mp_uint *rp,
+                          mp_uint *tp, struct mp_allocator *alloc)
+{
+    _Static_assert(MP_INVERT_THRESHOLD >= 4, "threshold too small");
+
+    if (n < MP_INVERT_THRESHOLD) {
+        mp_invert_basecase(ap, n, rp, tp, alloc);
+        return;
+    }
+
+    mp_size h = (n + 1) / 2;
+    mp_size l = n - h;
+    mp_uint *xp = tp;
+    mp_uint *ep = xp + h + 1;
+    mp_uint *pp = ep + n + h + 1;
+    mp_uint *yp = pp + n + h + 2;
+    mp_uint *wp = yp + n + 1;
+    mp_uint *zp = wp + n + l + 2;
+    mp_uint *dx = pp + 2 * h;
+
+    // x = B^h + 1 / a_hi
+    mp_invert_rec(ap + l, h, xp, ep, alloc);
+    xp[h] = 1;
+
+    // e = B^(n + h) - a x, at most 3 B^n in magnitude
+    mp_mul_with_alloc(ap, n, xp, h + 1, ep, alloc);
+
+    mp_bool neg = ep[n + h];
+
+    if (!neg) {
+        mp_negate(ep, n + h, ep);
+    }
+
+    MP_ENSURES(ep[n] <= 3);
+
+    // y = x B^l + e x / B^2h
+    mp_mul_with_alloc(ep, n + 1, xp, h + 1, pp, alloc);
+    mp_uint_zero(yp, l);
+    mp_uint_copy(xp, h + 1, yp + l);
+
+    if (neg) {
+        mp_sub(yp, n + 1, dx, l + 2, yp);
+    } else {
+        mp_add(yp, n + 1, dx, l + 2, yp);
+    }
+
+    // w = e B^l - a dx, and B^2n - 1 - a y = +-w - 1
+    mp_mul_with_alloc(ap, n, dx, l + 2, zp, alloc);
+    mp_uint_zero(wp, l);
+    mp_uint_copy(ep, n + 1, wp + l);
+    wp[n + l + 1] = 0;
+
+    mp_bool rneg = neg ^ mp_sub_n(wp, zp, n + l + 2, wp);
+
+    if (rneg != neg) {
+        mp_negate(wp, n + l + 2, wp);
+    }
+
+    MP_ENSURES(!wp[n + 1] && !wp[n + l + 1]);
+
+    if (rneg) {
+        mp_add_uint(wp, n + 1, 1, wp);
+    } else if (mp_sub_uint(wp, n + 1, 1, wp)) {
+        mp_uint_fill(wp, n + 1, 0);
+        wp[0] = 1;
+        rneg = mp_true;
+    }
+
+    // step y until 0 <= B^2n - 1 - a y < a
+    while (rneg) {
+        mp_sub_uint(yp, n + 1, 1, yp);
+
+        if (wp[n] || mp_cmp_n(wp, ap, n) > 0) {
+            wp[n] -= mp_sub_n(wp, ap, n, wp);
+        } else {
+            mp_sub_n(ap, wp, n, wp);
+            rneg = mp_false;
+        }
+    }
+
+    while (wp[n] || mp_cmp_n(wp, ap, n) >= 0) {
+        mp_add_uint(yp, n + 1, 1, yp);
+        wp[n] -= mp_sub_n(wp, ap, n, wp);
+    }
+
+    MP_ENSURES(yp[n] == 1);
+    mp_uint_copy(yp, n, rp);
+}
+
+enum mp_errc mp_invert(const mp_uint *ap, mp_size an, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+    MP_EXPECTS(ap[an - 1] >> (MP_UINT_WIDTH - 1));
+
+    struct mp_allocator *alloc = mp_get_default_allocator();
+    mp_size tn = mp_invert_scratch_size(an);
+    mp_uint *tp = mp_allocate_uint(alloc, tn);
+
+    if (!tp) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_invert_rec(ap, an, rp, tp, alloc);
+    mp_deallocate_uint(alloc, tp, tn);
+    return MP_ERRC_OK;
+}
+
+// Barrett step for 2n limbs of n by the normalized d, with i its inverse. The
+// estimate q = n_hi + n_hi i / B^n is short by at most two. The scratch t takes
+// 2n limbs.
+
+static mp_uint mp_div_barrett_n(mp_uint *np, const mp_uint *dp, mp_size n,
+                                const mp_uint *ip, mp_uint *qp, mp_uint *tp,
+                                struct mp_allocator *alloc)
+{
+    mp_uint qh = mp_cmp_n(np + n, dp, n) >= 0;
+
+    if (qh) {
+        mp_sub_n(np + n, dp, n, np + n);
+    }
+
+    mp_mul_with_alloc(np + n, n, ip, n, tp, alloc);
+    mp_add_n(tp + n, np + n, n, qp);
+
+    // only the low n + 1 limbs of the remainder are live
+    mp_mul_with_alloc(qp, n, dp, n, tp, alloc);
+    mp_sub_n(np, tp, n + 1, np);
+
+    while (np[n] || mp_cmp_n(np, dp, n) >= 0) {
+        mp_add_uint(qp, n, 1, qp);
+        np[n] -= mp_sub_n(np, dp, n, np);
+    }
+
+    return qh;
+}
+
+// Divides by a normalized divisor using its inverse, one block of dn quotient
+// limbs at a time. A partial block at the top goes through mp_div_dc_top. The
+// scratch t takes 2dn limbs.
+
+static mp_uint mp_div_barrett(mp_uint *np, mp_size nn, const mp_uint *dp,
+                              mp_size dn, mp_uint v, const mp_uint *ip,
+                              mp_uint *qp, mp_uint *tp,
+                              struct mp_allocator *alloc)
+{
+    MP_EXPECTS(nn >= 2 * dn);
+
+    mp_size qn = nn - dn;
+    mp_size b = qn % dn;
+    mp_size i = qn - b;
+    mp_uint qh;
+
+    if (b) {
+        qh = mp_div_dc_top(np + i, b, dp, dn, v, qp + i, tp, alloc);
+    } else {
+        i -= dn;
+        qh = mp_div_barrett_n(np + i, dp, dn, ip, qp + i, tp, alloc);
+    }
+
+    while (i) {
+        i -= dn;
+        mp_div_barrett_n(np + i, dp, dn, ip, qp + i, tp, alloc);
+    }
+
+    return qh;
+}
+
+// The inverse costs about two Barrett steps, so without a cached one it needs
+// a long quotient
+
+static mp_bool mp_div_use_newton(mp_size nn, mp_size dn, const mp_uint *ip)
+{
+    return !ip && dn >= MP_DIV_NEWTON_THRESHOLD && nn + 1 >= 5 * dn;
+}
+
+static mp_size mp_div_norm_scratch_size(mp_size nn, mp_size dn,
+                                        const mp_uint *ip, const mp_uint *qp)
+{
+    mp_size sn = 0;
+
+    if (mp_div_use_newton(nn, dn, ip)) {
+        mp_size tn = mp_invert_scratch_size(dn);
+
+        sn = dn + (tn > 2 * dn ? tn : 2 * dn);
+    } else if (ip) {
+        sn = 2 * dn;
+    } else if (dn >= MP_DIV_DC_THRESHOLD) {
+        sn = dn;
+    }
+
+    return nn + 1 + sn + (qp ? 0 : nn - dn + 1);
+}
+
+// Divides by the normalized d, with v the inverse of its top two limbs and i
+// its full inverse or NULL. n is shifted left by shift bits first and the
+// remainder shifted back into r. Leaves the quotient in q unless it is NULL.
+
+static void mp_div_norm(const mp_uint *np, mp_size nn, const mp_uint *dp,
+                        mp_size dn, mp_size shift, mp_uint v,
+                        const mp_uint *ip, mp_uint *qp, mp_uint *rp,
+                        mp_uint *tp, struct mp_allocator *alloc)
+{
+    MP_EXPECTS(dn >= 2);
+    MP_EXPECTS(nn >= dn);
+
+    mp_bool newton = mp_div_use_newton(nn, dn, ip);
+    mp_size sn = mp_div_norm_scratch_size(nn, dn, ip, qp) - nn - 1;
+    mp_uint *xp = tp;
+    mp_uint *sp = xp + nn + 1;
+    mp_uint *zp = qp ? qp : sp + sn - (nn - dn + 1);
+
+    if (shift) {
+        xp[nn] = mp_left_shift(np, nn, shift, xp);
+    } else {
+        xp[nn] = 0;
+        mp_uint_copy(np, nn, xp);
+    }
+
+    if (newton) {
+        mp_invert_rec(dp, dn, sp, sp + dn, alloc);
+        mp_div_barrett(xp, nn + 1, dp, dn, v, sp, zp, sp + dn, alloc);
+    } else if (ip && nn + 1 >= 2 * dn) {
+        mp_div_barrett(xp, nn + 1, dp, dn, v, ip, zp, sp, alloc);
+    } else if (dn >= MP_DIV_DC_THRESHOLD) {
+        mp_div_dc(xp, nn + 1, dp, dn, v, zp, sp, alloc);
+    } else {
+        mp_div_basecase(xp, nn + 1, dp, dn, v, zp);
+    }
+
+    if (shift) {
+        mp_right_shift(xp, dn, shift, rp);
+    } else {
+        mp_uint_copy(xp, dn, rp);
+    }
+}
+
+enum mp_errc mp_div_with_alloc(const mp_uint *np, mp_size nn,
+                               const mp_uint *dp, mp_size dn, mp_uint *qp,
+                               mp_uint *rp, struct mp_allocator *alloc)
+{
+    MP_EXPECTS(nn >= dn);
+    MP_EXPECTS(dn);
+    MP_EXPECTS(dp[dn - 1]);
+
+    mp_size shift = mp_uint_countl_zero(dp[dn - 1]);
+
+    if (dn == 1) {
+        mp_uint d = *dp << shift;
+
+        *rp = mp_div_uint_norm(np, nn, d, shift, mp_uint_inv(d), qp);
+        return MP_ERRC_OK;
+    }
+
+    mp_size tn = dn + mp_div_norm_scratch_size(nn, dn, NULL, qp);
+    mp_uint *tp = mp_allocate_uint(alloc, tn);
+
+    if (!tp) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_uint *yp = tp;
+
+    if (shift) {
+        mp_left_shift(dp, dn, shift, yp);
+    } else {
+        mp_uint_copy(dp, dn, yp);
+    }
+
+    mp_uint v = mp_uint_inv_3by2(yp[dn - 1], yp[dn - 2]);
+
+    mp_div_norm(np, nn, yp, dn, shift, v, NULL, qp, rp, tp + dn, alloc);
+    mp_deallocate_uint(alloc, tp, tn);
+    return MP_ERRC_OK;
+}
+
+enum mp_errc mp_div(const mp_uint *np, mp_size nn, const mp_uint *dp,
+                    mp_size dn, mp_uint *qp, mp_uint *rp)
+{
+    MP_EXPECTS(qp);
+
+    return mp_div_with_alloc(
+        np, nn, dp, dn, qp, rp, mp_get_default_allocator());
+}
+
+mp_uint mp_mod_uint(const mp_uint *np, mp_size nn, mp_uint d)
+{
+    MP_EXPECTS(d);
+
+    mp_size shift = mp_uint_countl_zero(d);
+
+    d <<= shift;
+    return mp_div_uint_norm(np, nn, d, shift, mp_uint_inv(d), NULL);
+}
+
+// r = (r B + a) mod d, for the normalized d and r, which are both shifted left
+// by s bits
+
+static inline mp_uint mp_mod_uint_step(
+    mp_uint r, mp_uint a, mp_uint d, mp_uint v, mp_size s)
+{
+    mp_uint_div_inv(r | (a >> 1 >> (MP_UINT_WIDTH - 1 - s)), a << s, d, v, &r);
+    return r;
+}
+
+// a is read in blocks from the top, and each block is reduced by every
+// modulus while it is in cache. The inverses are recomputed per block rather
+// than stored, and two moduli are reduced side by side so that their
+// dependency chains overlap.
+
+void mp_mod_uint_multi(const mp_uint *ap, mp_size an, const mp_uint *moduli,
+                       mp_size k, mp_uint *residues)
+{
+    MP_EXPECTS(an);
+
+    mp_uint_zero(residues, k);
+
+    for (mp_size end = an; end;) {
+        mp_size begin = end > MP_MOD_UINT_MULTI_BLOCK
+                            ? end - MP_MOD_UINT_MULTI_BLOCK
+                            : 0;
+        mp_size j = 0;
+
+        for (; j + 1 < k; j += 2) {
+            MP_EXPECTS(moduli[j] && moduli[j + 1]);
+
+            mp_size s0 = mp_uint_countl_zero(moduli[j]);
+            mp_size s1 = mp_uint_countl_zero(moduli[j + 1]);
+            mp_uint d0 = moduli[j] << s0;
+            mp_uint d1 = moduli[j + 1] << s1;
+            mp_uint v0 = mp_uint_inv(d0);
+            mp_uint v1 = mp_uint_inv(d1);
+            mp_uint r0 = residues[j];
+            mp_uint r1 = residues[j + 1];
+
+            for (mp_size i = end; i-- > begin;) {
+                r0 = mp_mod_uint_step(r0, ap[i], d0, v0, s0);
+                r1 = mp_mod_uint_step(r1, ap[i], d1, v1, s1);
+            }
+
+            residues[j] = r0;
+            residues[j + 1] = r1;
+        }
+
+        if (j < k) {
+            MP_EXPECTS(moduli[j]);
+
+            mp_size s = mp_uint_countl_zero(moduli[j]);
+            mp_uint d = moduli[j] << s;
+            mp_uint v = mp_uint_inv(d);
+            mp_uint r = residues[j];
+
+            for (mp_size i = end; i-- > begin;) {
+                r = mp_mod_uint_step(r, ap[i], d, v, s);
+            }
+
+            residues[j] = r;
+        }
+
+        end = begin;
+    }
+
+    for (mp_size j = 0; j < k; j++) {
+        residues[j] >>= mp_uint_countl_zero(moduli[j]);
+    }
+}
+
+enum mp_errc mp_mod(const mp_uint *np, mp_size nn, const mp_uint *dp,
+                    mp_size dn, mp_uint *rp)
+{
+    return mp_div_with_alloc(
+        np, nn, dp, dn, NULL, rp, mp_get_default_allocator());
+}
+
+enum mp_errc mp_divisor_construct(struct mp_divisor *div, const mp_uint *dp,
+                                  mp_size dn, struct mp_allocator *alloc)
+{
+    MP_EXPECTS(dn);
+    MP_EXPECTS(dp[dn - 1]);
+
+    mp_bool invert = dn >= MP_DIVISOR_INVERT_THRESHOLD;
+    mp_size cn = invert ? 2 * dn : dn;
+
+    div->_alloc = alloc ? alloc : mp_get_default_allocator();
+    div->_data = mp_allocate_uint(div->_alloc, cn);
+
+    if (!div->_data) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_uint *yp = div->_data;
+
+    div->_size = dn;
+    div->_capacity = cn;
+    div->_shift = mp_uint_countl_zero(dp[dn - 1]);
+    div->_inverse = invert ? yp + dn : NULL;
+
+    if (div->_shift) {
+        mp_left_shift(dp, dn, div->_shift, yp);
+    } else {
+        mp_uint_copy(dp, dn, yp);
+    }
+
+    if (dn == 1) {
+        div->_inv = mp_uint_inv(*yp);
+    } else {
+        div->_inv = mp_uint_inv_3by2(yp[dn - 1], yp[dn - 2]);
+    }
+
+    if (invert) {
+        mp_size tn = mp_invert_scratch_size(dn);
+        mp_uint *tp = mp_allocate_uint(div->_alloc, tn);
+
+        if (!tp) {
+            mp_deallocate_uint(div->_alloc, div->_data, cn);
+            return MP_ERRC_NOT_ENOUGH_MEMORY;
+        }
+
+        mp_invert_rec(yp, dn, div->_inverse, tp, div->_alloc);
+        mp_deallocate_uint(div->_alloc, tp, tn);
+    }
+
+    return MP_ERRC_OK;
+}
+
+void mp_divisor_destruct(struct mp_divisor *div)
+{
+    mp_deallocate_uint(div->_alloc, div->_data, div->_capacity);
+}
+
+enum mp_errc mp_div_pre(const mp_uint *np, mp_size nn,
+                        const struct mp_divisor *div, mp_uint *qp,
+                        mp_uint *rp)
+{
+    mp_size dn = div->_size;
+    const mp_uint *yp = div->_data;
+
+    MP_EXPECTS(nn >= dn);
+
+    if (dn == 1) {
+        *rp = mp_div_uint_norm(np, nn, *yp, div->_shift, div->_inv, qp);
+        return MP_ERRC_OK;
+    }
+
+    const mp_uint *ip = div->_inverse;
+    mp_size tn = mp_div_norm_scratch_size(nn, dn, ip, qp);
+    mp_uint *tp = mp_allocate_uint(div->_alloc, tn);
+
+    if (!tp) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_div_norm(np, nn, yp, dn, div->_shift, div->_inv, ip, qp, rp, tp,
+                div->_alloc);
+    mp_deallocate_uint(div->_alloc, tp, tn);
+    return MP_ERRC_OK;
+}
+
+enum mp_errc mp_mod_pre(const mp_uint *np, mp_size nn,
+                        const struct mp_divisor *div, mp_uint *rp)
+{
+    return mp_div_pre(np, nn, div, NULL, rp);
+}
+
+// q_i = (n_i - c) / d mod B, where c is the high limb of q_(i-1) d plus the
+// borrow. The power of two in d is shifted out of n on the fly.
+
+void mp_divexact_uint(const mp_uint *np, mp_size nn, mp_uint d, mp_uint *qp)
+{
+    MP_EXPECTS(nn);
+    MP_EXPECTS(d);
+
+    mp_size shift = mp_uint_countr_zero(d);
+    mp_uint c = 0;
+
+    d >>= shift;
+
+    mp_uint v = mp_uint_binvert(d);
+
+    if (shift) {
+        mp_size lshift = MP_UINT_WIDTH - shift;
+        mp_uint next = *np;
+
+        for (mp_size i = 1; i < nn; i++) {
+            mp_uint n = next >> shift;
+
+            next = np[i];
+            n |= next << lshift;
+
+            mp_uint q = (n - c) * v;
+
+            c = mp_uint_mulhi(q, d) + (n < c);
+            qp[i - 1] = q;
+        }
+
+        qp[nn - 1] = ((next >> shift) - c) * v;
+    } else {
+        for (mp_size i = 0; i < nn; i++) {
+            mp_uint n = np[i];
+            mp_uint q = (n - c) * v;
+
+            c = mp_uint_mulhi(q, d) + (n < c);
+            qp[i] = q;
+        }
+    }
+}
+
+// q = n / d mod B^qn, computed in place of n from the low limb up, for odd d
+// with dn <= qn and v = 1 / d mod B. The borrow of each step into limb i + dn
+// is carried along instead of being propagated through the rest of n.
+
+static void mp_divexact_basecase(
+    mp_uint *qp, mp_size qn, const mp_uint *dp, mp_size dn, mp_uint v)
+{
+    mp_uint b = 0;
+
+    for (mp_size i = 0; i < qn; i++) {
+        mp_uint q = qp[i] * v;
+
+        if (qn - i > dn) {
+            mp_uint c = mp_submul_uint(dp, dn, q, qp + i);
+            mp_uint x = qp[i + dn];
+            mp_uint y = x - c;
+
+            qp[i + dn] = y - b;
+            b = (x < c) + (y < b);
+        } else {
+            mp_submul_uint(dp, qn - i, q, qp + i);
+        }
+
+        qp[i] = q;
+    }
+}
+
+// Splits q into a low and a high half, and removes the low half times d from
+// n before solving for the high half. The scratch t takes 2qn limbs.
+
+static void mp_divexact_dc(mp_uint *qp, mp_size qn, const mp_uint *dp,
+                           mp_size dn, mp_uint v, mp_uint *tp,
+                           struct mp_allocator *alloc)
+{
+    if (dn < MP_DIVEXACT_DC_THRESHOLD) {
+        mp_divexact_basecase(qp, qn, dp, dn, v);
+        return;
+    }
+
+    mp_size lo = qn / 2;
+    mp_size hi = qn - lo;
+
+    mp_divexact_dc(qp, lo, dp, dn < lo ? dn : lo, v, tp, alloc);
+
+    if (lo >= dn) {
+        mp_mul_with_alloc(qp, lo, dp, dn, tp, alloc);
+    } else {
+        mp_mul_with_alloc(dp, dn, qp, lo, tp, alloc);
+    }
+
+    mp_sub(qp + lo, hi, tp + lo, dn < hi ? dn : hi, qp + lo);
+    mp_divexact_dc(qp + lo, hi, dp, dn < hi ? dn : hi, v, tp, alloc);
+}
+
+enum mp_errc mp_divexact_with_alloc(const mp_uint *np, mp_size nn,
+                                    const mp_uint *dp, mp_size dn, mp_uint *qp,
+                                    struct mp_allocator *alloc)
+{
+    MP_EXPECTS(nn >= dn);
+    MP_EXPECTS(dn);
+    MP_EXPECTS(dp[dn - 1]);
+
+    // the low zero limbs of d are shared by n
+    while (!*dp) {
+        MP_EXPECTS(!*np);
+        ++dp, --dn;
+        ++np, --nn;
+    }
+
+    if (dn == 1) {
+        mp_divexact_uint(np, nn, *dp, qp);
+        return MP_ERRC_OK;
+    }
+
+    // only the low qn limbs of n and d take part, after dropping the common
+    // power of two
+    mp_size qn = nn - dn + 1;
+    mp_size yn = dn < qn ? dn : qn;
+    mp_size shift = mp_uint_countr_zero(*dp);
+    mp_size sn = shift ? yn : 0;
+    mp_size tn = sn + (yn >= MP_DIVEXACT_DC_THRESHOLD ? 2 * qn : 0);
+    mp_uint *tp = NULL;
+
+    if (tn && !(tp = mp_allocate_uint(alloc, tn))) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    const mp_uint *yp = dp;
+
+    if (shift) {
+        mp_uint *sp = tp + tn - sn;
+
+        mp_right_shift(dp, yn, shift, sp);
+
+        if (yn < dn) {
+            sp[yn - 1] |= dp[yn] << (MP_UINT_WIDTH - shift);
+        }
+
+        mp_right_shift(np, qn, shift, qp);
+        qp[qn - 1] |= np[qn] << (MP_UINT_WIDTH - shift);
+        yp = sp;
+    } else if (np != qp) {
+        mp_uint_move(np, qn, qp);
+    }
+
+    mp_divexact_dc(qp, qn, yp, yn, mp_uint_binvert(*yp), tp, alloc);
+
+    if (tp) {
+        mp_deallocate_uint(alloc, tp, tn);
+    }
+
+    return MP_ERRC_OK;
+}
+
+enum mp_errc mp_divexact(const mp_uint *np, mp_size nn, const mp_uint *dp,
+                         mp_size dn, mp_uint *qp)
+{
+    return mp_divexact_with_alloc(
+        np, nn, dp, dn, qp, mp_get_default_allocator());
+}
+
+// Runs the exact division by the odd part of d without storing the quotient.
+// The final borrow c satisfies q d = n + c B^nn for q < B^nn, so it is zero
+// exactly when the odd part divides n.
+
+mp_bool mp_divisible_uint(const mp_uint *np, mp_size nn, mp_uint d)
+{
+    MP_EXPECTS(nn);
+    MP_EXPECTS(d);
+
+    mp_size shift = mp_uint_countr_zero(d);
+
+    if (*np & (((mp_uint)1 << shift) - 1)) {
+        return mp_false;
+    }
+
+    d >>= shift;
+
+    if (d == 1) {
+        return mp_true;
+    }
+
+    mp_uint v = mp_uint_binvert(d);
+    mp_uint c = 0;
+
+    for (mp_size i = 0; i < nn; i++) {
+        mp_uint n = np[i];
+        mp_uint q = (n - c) * v;
+
+        c = mp_uint_mulhi(q, d) + (n < c);
+    }
+
+    return !c;
+}
+
+mp_bool mp_divisible_2exp(const mp_uint *np, mp_size nn, mp_size k)
+{
+    MP_EXPECTS(nn);
+
+    if (!k) {
+        return mp_true;
+    }
+
+    mp_size kn = (k - 1) / MP_UINT_WIDTH + 1;
+
+    if (kn >= nn) {
+        kn = nn;
+        k = k < nn * MP_UINT_WIDTH ? k : nn * MP_UINT_WIDTH;
+    }
+
+    return mp_countr_zero(np, kn) >= k;
+}
+
+mp_uint mp_left_shift_generic(
+    const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+    MP_EXPECTS(bits < MP_UINT_WIDTH);
+    MP_EXPECTS(bits);
+
+    mp_uint rbits = MP_UINT_WIDTH - bits;
+    mp_uint next = ap[--an];
+    mp_uint ret = next >> rbits;
+
+    while (an) {
+        mp_uint prev = ap[--an];
+        rp[an + 1] = (next << bits) | (prev >> rbits);
+        next = prev;
+    }
+
+    *rp = next << bits;
+    return ret;
+}
+
+mp_uint mp_left_shift(const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp)
+{
+    return MP_KERNEL(left_shift)(ap, an, bits, rp);
+}
+
+mp_uint mp_right_shift_generic(
+    const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+    MP_EXPECTS(bits < MP_UINT_WIDTH);
+    MP_EXPECTS(bits);
+
+    mp_uint lbits = MP_UINT_WIDTH - bits;
+    mp_uint prev = *ap;
+    mp_uint ret = prev << lbits;
+
+    while (--an) {
+        mp_uint next = *++ap;
+        *rp++ = (prev >> bits) | (next << lbits);
+        prev = next;
+    }
+
+    *rp = prev >> bits;
+    return ret;
+}
+
+mp_uint mp_right_shift(const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp)
+{
+    return MP_KERNEL(right_shift)(ap, an, bits, rp);
+}
+
+void mp_bit_and_n_generic(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    MP_EXPECTS(n);
+
+    do {
+        *rp++ = *ap++ & *bp++;
+    } while (--n);
+}
+
+void mp_bit_and_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    MP_KERNEL(bit_and_n)(ap, bp, n, rp);
+}
+
+void mp_bit_and(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
+                mp_uint *rp)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
+
+    mp_bit_and_n(ap, bp, bn, rp);
+    mp_uint_zero(rp + bn, an - bn);
+}
+
+void mp_bit_or_n_generic(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    MP_EXPECTS(n);
+
+    do {
+        *rp++ = *ap++ | *bp++;
+    } while (--n);
+}
+
+void mp_bit_or_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    MP_KERNEL(bit_or_n)(ap, bp, n, rp);
+}
+
+void mp_bit_or(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
+               mp_uint *rp)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
+
+    mp_bit_or_n(ap, bp, bn, rp);
+    mp_uint_move(ap + bn, an - bn, rp + bn);
+}
+
+void mp_bit_xor_n_generic(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    MP_EXPECTS(n);
+
+    do {
+        *rp++ = *ap++ ^ *bp++;
+    } while (--n);
+}
+
+void mp_bit_xor_n(const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    MP_KERNEL(bit_xor_n)(ap, bp, n, rp);
+}
+
+void mp_bit_xor(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn,
+                mp_uint *rp)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
+
+    mp_bit_xor_n(ap, bp, bn, rp);
+    mp_uint_move(ap + bn, an - bn, rp + bn);
+}
+
+void mp_bit_not_generic(const mp_uint *ap, mp_size an, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+
+    do {
+        *rp++ = ~*ap++;
+    } while (--an);
+}
+
+void mp_bit_not(const mp_uint *ap, mp_size an, mp_uint *rp)
+{
+    MP_KERNEL(bit_not)(ap, an, rp);
+}
+
+// -a = ~(a - 1)
+
+mp_uint mp_negate(const mp_uint *ap, mp_size an, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+
+    mp_uint c = 1;
+    do {
+        mp_uint a = *ap++;
+        mp_uint r = ~(a - c);
+
+        c = a < c;
+        *rp++ = r;
+    } while (--an);
+    return c;
+}
+
+mp_bool mp_equal_n(const mp_uint *ap, const mp_uint *bp, mp_size n)
+{
+    MP_EXPECTS(n);
+
+    return !memcmp(ap, bp, sizeof(mp_uint) * n);
+}
+
+mp_bool mp_equal(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn)
+{
+    MP_EXPECTS(an);
+    MP_EXPECTS(bn);
+
+    return an == bn && mp_equal_n(ap, bp, bn);
+}
+
+int mp_cmp_n(const mp_uint *ap, const mp_uint *bp, mp_size n)
+{
+    MP_EXPECTS(n);
+
+    do {
+        mp_uint a = ap[--n];
+        mp_uint b = bp[n];
+
+        if (a > b) {
+            return 1;
+        } else if (a < b) {
+            return -1;
+        }
+    } while (n);
+
+    return 0;
+}
+
+int mp_cmp(const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn)
+{
+    MP_EXPECTS(an);
+    MP_EXPECTS(bn);
+
+    return an == bn ? mp_cmp_n(ap, bp, an) : an > bn ? 1 : an < bn ? -1 : 0;
+}
+
+int mp_cmp_uint(const mp_uint *ap, mp_size an, mp_uint b)
+{
+    MP_EXPECTS(an);
+
+    return mp_cmp(ap, an, &b, 1);
+}
+
+mp_size mp_has_single_bit(const mp_uint *ap, mp_size an)
+{
+    MP_EXPECTS(an);
+
+    do {
+        mp_uint a = ap[--an];
+
+        if (a) {
+            if (!mp_uint_has_single_bit(a)) {
+                return mp_false;
+            }
+
+            while (an) {
+                if (ap[--an]) {
+                    return mp_false;
+                }
+            }
+
+            return mp_true;
+        }
+    } while (an);
+
+    return mp_false;
+}
+
+mp_size mp_countl_zero(const mp_uint *ap, mp_size an)
+{
+    MP_EXPECTS(an);
+
+    mp_size n = an;
+    do {
+        mp_uint a = ap[--n];
+
+        if (a) {
+            return mp_uint_countl_zero(a) + MP_UINT_WIDTH * (an - n - 1);
+        }
+    } while (n);
+    return MP_UINT_WIDTH * an;
+}
+
+mp_size mp_countl_one(const mp_uint *ap, mp_size an)
+{
+    MP_EXPECTS(an);
+
+    mp_size n = an;
+    do {
+        mp_uint a = ap[--n];
+
+        if (~a) {
+            return mp_uint_countl_one(a) + MP_UINT_WIDTH * (an - n - 1);
+        }
+    } while (n);
+    return MP_UINT_WIDTH * an;
+}
+
+mp_size mp_countr_zero(const mp_uint *ap, mp_size an)
+{
+    MP_EXPECTS(an);
+
+    mp_size n = 0;
+    do {
+        mp_uint a = ap[n];
+
+        if (a) {
+            return mp_uint_countr_zero(a) + MP_UINT_WIDTH * n;
+        }
+    } while (++n != an);
+    return MP_UINT_WIDTH * an;
+}
+
+mp_size mp_countr_one(const mp_uint *ap, mp_size an)
+{
+    MP_EXPECTS(an);
+
+    mp_size n = 0;
+    do {
+        mp_uint a = ap[n];
+
+        if (~a) {
+            return mp_uint_countr_one(a) + MP_UINT_WIDTH * n;
+        }
+    } while (++n != an);
+    return MP_UINT_WIDTH * an;
+}
+
+mp_size mp_bit_width(const mp_uint *ap, mp_size an)
+{
+    MP_EXPECTS(an);
+
+    return an * MP_UINT_WIDTH - mp_countl_zero(ap, an);
+}
+
+mp_size mp_popcount_generic(const mp_uint *ap, mp_size an)
+{
+    MP_EXPECTS(an);
+
+    mp_size count = 0;
+    do {
+        count += mp_uint_popcount(ap[--an]);
+    } while (an);
+    return count;
+}
+
+mp_size mp_popcount(const mp_uint *ap, mp_size an)
+{
+    return MP_KERNEL(popcount)(ap, an);
+}
+
+mp_size mp_hamming_n_generic(const mp_uint *ap, const mp_uint *bp, mp_size n)
+{
+    MP_EXPECTS(n);
+
+    mp_size count = 0;
+    do {
+        --n;
+        count += mp_uint_popcount(ap[n] ^ bp[n]);
+    } while (n);
+    return count;
+}
+
+mp_size mp_hamming_distance(
+    const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
+
+    mp_size count = MP_KERNEL(hamming_n)(ap, bp, bn);
+
+    if (an > bn) {
+        count += mp_popcount(ap + bn, an - bn);
+    }
+
+    return count;
+}
+
+// Whole limbs go to and from bytes with a copy in the native order, and with
+// the store_be and load_be kernels in big endian order, which reverse the
+// bytes of a run of limbs. Only a partial top limb is taken a byte at a time.
+
+void mp_store_be_generic(const mp_uint *ap, mp_size n, mp_byte *bytes)
+{
+    for (mp_size i = 0; i < n; i++) {
+        mp_uint x = ap[n - 1 - i];
+
+        if (MP_ENDIAN_NATIVE == MP_ENDIAN_LITTLE) {
+            x = mp_uint_bswap(x);
+        }
+
+        memcpy(bytes + i * sizeof(x), &x, sizeof(x));
+    }
+}
+
+void mp_load_be_generic(const mp_byte *bytes, mp_size n, mp_uint *rp)
+{
+    for (mp_size i = 0; i < n; i++) {
+        mp_uint x;
+
+        memcpy(&x, bytes + i * sizeof(x), sizeof(x));
+
+        if (MP_ENDIAN_NATIVE == MP_ENDIAN_LITTLE) {
+            x = mp_uint_bswap(x);
+        }
+
+        rp[n - 1 - i] = x;
+    }
+}
+
+static mp_size mp_byte_width(const mp_uint *ap, mp_size an)
+{
+    return an ? (mp_bit_width(ap, an) + 7) / 8 : 0;
+}
+
+// The low n bytes of a
+
+static void mp_to_bytes_le(const mp_uint *ap, mp_size n, mp_byte *bytes)
+{
+    mp_size full = n / sizeof(mp_uint);
+
+    if (MP_ENDIAN_NATIVE == MP_ENDIAN_LITTLE) {
+        memcpy(bytes, ap, full * sizeof(mp_uint));
+    } else {
+        for (mp_size i = 0; i < full; i++) {
+            mp_uint x = mp_uint_bswap(ap[i]);
+
+            memcpy(bytes + i * sizeof(x), &x, sizeof(x));
+        }
+    }
+
+    for (mp_size i = full * sizeof(mp_uint); i < n; i++) {
+        bytes[i] = ap[full] >> (i % sizeof(mp_uint) * 8);
+    }
+}
+
+static void mp_to_bytes_be(const mp_uint *ap, mp_size n, mp_byte *bytes)
+{
+    mp_size full = n / sizeof(mp_uint);
+    mp_size top = n % sizeof(mp_uint);
+
+    for (mp_size i = 0; i < top; i++) {
+        bytes[i] = ap[full] >> ((top - 1 - i) * 8);
+    }
+
+    if (full) {
+        MP_KERNEL(store_be)(ap, full, bytes + top);
+    }
+}
+
+mp_size mp_to_bytes(const mp_uint *ap, mp_size an, mp_byte *bytes,
+                    enum mp_endian endian)
+{
+    mp_size n = mp_byte_width(ap, an);
+
+    if (endian == MP_ENDIAN_LITTLE) {
+        mp_to_bytes_le(ap, n, bytes);
+    } else {
+        mp_to_bytes_be(ap, n, bytes);
+    }
+
+    return n;
+}
+
+enum mp_errc mp_to_bytes_padded(const mp_uint *ap, mp_size an, mp_byte *bytes,
+                                mp_size byte_count, enum mp_endian endian)
+{
+    mp_size n = mp_byte_width(ap, an);
+
+    if (n > byte_count) {
+        return MP_ERRC_VALUE_TOO_LARGE;
+    }
+
+    if (endian == MP_ENDIAN_LITTLE) {
+        mp_to_bytes_le(ap, n, bytes);
+        memset(bytes + n, 0, byte_count - n);
+    } else {
+        memset(bytes, 0, byte_count - n);
+        mp_to_bytes_be(ap, n, bytes + byte_count - n);
+    }
+
+    return MP_ERRC_OK;
+}
+
+mp_size mp_from_bytes(const mp_byte *bytes, mp_size byte_count, mp_uint *rp,
+                      enum mp_endian endian)
+{
+    mp_size full = byte_count / sizeof(mp_uint);
+    mp_size top = byte_count % sizeof(mp_uint);
+    mp_size rn = full + !!top;
+    mp_uint c = 0;
+
+    if (endian == MP_ENDIAN_LITTLE) {
+        if (MP_ENDIAN_NATIVE == MP_ENDIAN_LITTLE) {
+            memcpy(rp, bytes, full * sizeof(mp_uint));
+        } else {
+            for (mp_size i = 0; i < full; i++) {
+                memcpy(rp + i, bytes + i * sizeof(mp_uint), sizeof(mp_uint));
+                rp[i] = mp_uint_bswap(rp[i]);
+            }
+        }
+
+        for (mp_size i = byte_count; i != full * sizeof(mp_uint); i--) {
+            c = c << 8 | bytes[i - 1];
+        }
+    } else {
+        for (mp_size i = 0; i < top; i++) {
+            c = c << 8 | bytes[i];
+        }
+
+        if (full) {
+            MP_KERNEL(load_be)(bytes + top, full, rp);
+        }
+    }
+
+    if (top) {
+        rp[full] = c;
+    }
+
+    while (rn && !rp[rn - 1]) {
+        --rn;
+    }
+
+    return rn;
+}
+
+static struct mp_to_string_result mp_to_string_zero(char *first, char *last)
+{
+    if (last - first < 1) {
+        return mp_to_string_no_mem(first);
+    }
+
+    *first++ = '0';
+    return mp_to_string_ok(first);
+}
+
+static const char mp_digit_chars[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+// Output in a base 2^b takes the bits in windows of 48, or 40 for base 32, and
+// writes each window a unit of u bits at a time, copying the u / b digits of
+// the unit from a table. The digits above the last whole window are written
+// one at a time.
+
+#define MP_OCT_ROW(d) d "0" d "1" d "2" d "3" d "4" d "5" d "6" d "7"
+#define MP_HEX_ROW(d)                                                          \
+    d "0" d "1" d "2" d "3" d "4" d "5" d "6" d "7" d "8" d "9" d "a" d "b"    \
+    d "c" d "d" d "e" d "f"
+
+static const struct {
+    const char *units;
+    mp_size unit_bits;
+    mp_size window;
+} mp_pow2_formats[] = {
+    [1] = {"0000" "0001" "0010" "0011" "0100" "0101" "0110" "0111"
+           "1000" "1001" "1010" "1011" "1100" "1101" "1110" "1111", 4, 48},
+    [2] = {"00" "01" "02" "03" "10" "11" "12" "13"
+           "20" "21" "22" "23" "30" "31" "32" "33", 4, 48},
+    [3] = {MP_OCT_ROW("0") MP_OCT_ROW("1") MP_OCT_ROW("2") MP_OCT_ROW("3")
+           MP_OCT_ROW("4") MP_OCT_ROW("5") MP_OCT_ROW("6") MP_OCT_ROW("7"),
+           6, 48},
+    [4] = {MP_HEX_ROW("0") MP_HEX_ROW("1") MP_HEX_ROW("2") MP_HEX_ROW("3")
+           MP_HEX_ROW("4") MP_HEX_ROW("5") MP_HEX_ROW("6") MP_HEX_ROW("7")
+           MP_HEX_ROW("8") MP_HEX_ROW("9") MP_HEX_ROW("a") MP_HEX_ROW("b")
+           MP_HEX_ROW("c") MP_HEX_ROW("d") MP_HEX_ROW("e") MP_HEX_ROW("f"),
+           8, 48},
+    [5] = {"0123456789abcdefghijklmnopqrstuv", 5, 40},
+};
+
+// The limb's worth of bits of a from bit pos on, zero above the top
+
+static inline mp_uint mp_bits_at(const mp_uint *ap, mp_size an, mp_size pos)
+{
+    mp_size i = pos / MP_UINT_WIDTH;
+    mp_size shift = pos % MP_UINT_WIDTH;
+    mp_uint x = ap[i] >> shift;
+
+    if (shift && i + 1 < an) {
+        x |= ap[i + 1] << (MP_UINT_WIDTH - shift);
+    }
+
+    return x;
+}
+
+// Writes the windows of a below bit pos. It is inlined for each b, so that
+// the copies of the units have fixed sizes.
+
+static inline char *mp_to_string_pow2_windows(
+    char *p, const mp_uint *ap, mp_size an, mp_size pos, mp_size b)
+{
+    const char *units = mp_pow2_formats[b].units;
+    mp_size u = mp_pow2_formats[b].unit_bits;
+    mp_size window = mp_pow2_formats[b].window * MP_UINT_WIDTH / 64;
+    mp_size chars = u / b;
+    mp_uint mask = ((mp_uint)1 << u) - 1;
+
+    while (pos) {
+        pos -= window;
+
+        mp_uint x = mp_bits_at(ap, an, pos);
+
+        for (mp_size shift = window; shift;) {
+            shift -= u;
+            memcpy(p, units + (x >> shift & mask) * chars, chars);
+            p += chars;
+        }
+    }
+
+    return p;
+}
+
+static struct mp_to_string_result mp_to_string_pow2(
+    char *first, char *last, const mp_uint *ap, mp_size an, mp_size b)
+{
+    mp_size bit_width = mp_bit_width(ap, an);
+
+    if (!bit_width) {
+        return mp_to_string_zero(first, last);
+    }
+
+    mp_size digits = (bit_width + b - 1) / b;
+
+    if (last - first < digits) {
+        return mp_to_string_no_mem(first);
+    }
+
+    mp_size window = mp_pow2_formats[b].window * MP_UINT_WIDTH / 64;
+    mp_size top = digits % (window / b);
+    mp_size pos = (digits - top) * b;
+
+    while (top) {
+        mp_uint x = mp_bits_at(ap, an, pos + --top * b);
+
+        *first++ = mp_digit_chars[x & (((mp_uint)1 << b) - 1)];
+    }
+
+    switch (b) {
+    case 1:
+        first = mp_to_string_pow2_windows(first, ap, an, pos, 1);
+        break;
+    case 2:
+        first = mp_to_string_pow2_windows(first, ap, an, pos, 2);
+        break;
+    case 3:
+        first = mp_to_string_pow2_windows(first, ap, an, pos, 3);
+        break;
+    case 4:
+        first = mp_to_string_pow2_windows(first, ap, an, pos, 4);
+        break;
+    default:
+        first = mp_to_string_pow2_windows(first, ap, an, pos, 5);
+    }
+
+    return mp_to_string_ok(first);
+}
+
+// Decimal output splits a on the powers p_k = 10^(D 2^k), squared up from
+// 10^D, the largest power of ten in a limb. A part below p_k^2 is divided by
+// p_k, and the quotient and the remainder, padded with zeros to D 2^k
+// digits, are written in turn. The divisions at the top dominate, so the
+// cost is O(M(n) log n). Parts of up to MP_TO_STRING_DC_THRESHOLD limbs are
+// written D digits at a time by division by 10^D with a fixed inverse.
+//
+// The powers end in D 2^k zero bits, so their zero low limbs are cut off
+// and only the high limbs of a part are divided, the low ones going straight
+// to the remainder.
+
+#if MP_UINT_WIDTH == 64
+#define MP_DEC_DIGITS 19
+#define MP_DEC_BASE ((mp_uint)10000000000000000000u)
+#else
+#define MP_DEC_DIGITS 9
+#define MP_DEC_BASE ((mp_uint)1000000000u)
+#endif
+
+struct mp_to_string_10_ctx {
+    struct mp_divisor powers[MP_UINT_WIDTH];
+    mp_size sizes[MP_UINT_WIDTH];
+    mp_size zeros[MP_UINT_WIDTH];
+    mp_uint base;
+    mp_uint inv;
+    mp_size shift;
+    char *buf;
+    mp_size bufn;
+};
+
+// Writes x, which is destroyed, as exactly width digits, or without leading
+// zeros when width is 0
+
+static char *mp_to_string_10_basecase(char *first, mp_uint *xp, mp_size xn,
+                                      mp_size width,
+                                      const struct mp_to_string_10_ctx *ctx)
+{
+    char *end = ctx->buf + ctx->bufn;
+    char *p = end;
+
+    while (xn) {
+        mp_uint r = mp_div_uint_norm(
+            xp, xn, ctx->base, ctx->shift, ctx->inv, xp);
+
+        xn -= !xp[xn - 1];
+
+        for (mp_size i = 0; i < MP_DEC_DIGITS; i++) {
+            *--p = '0' + r % 10;
+            r /= 10;
+        }
+    }
+
+    if (width) {
+        memset(first, '0', width - (end - p));
+        first += width - (end - p);
+    } else {
+        while (p != end && *p == '0') {
+            ++p;
+        }
+    }
+
+    memcpy(first, p, end - p);
+    return first + (end - p);
+}
+
+// Writes x < p_k^2, which is destroyed, as with mp_to_string_10_basecase.
+// The quotient and the remainder of each level are kept in t, which takes
+// 2 |p_k| + 1 limbs for this level and as much again for each level below.
+// Returns NULL when out of memory.
+
+static char *mp_to_string_10_rec(char *first, mp_uint *xp, mp_size xn,
+                                 mp_size k, mp_size width, mp_uint *tp,
+                                 const struct mp_to_string_10_ctx *ctx)
+{
+    while (xn && !xp[xn - 1]) {
+        --xn;
+    }
+
+    if (xn <= MP_TO_STRING_DC_THRESHOLD) {
+        return mp_to_string_10_basecase(first, xp, xn, width, ctx);
+    }
+
+    mp_size half = width ? width / 2 : 0;
+    mp_size pn = ctx->sizes[k];
+    mp_size z = ctx->zeros[k];
+
+    if (xn < pn) {
+        memset(first, '0', half);
+        return mp_to_string_10_rec(
+            first + half, xp, xn, k - 1, half, tp, ctx);
+    }
+
+    mp_size qn = xn - pn + 1;
+    mp_uint *qp = tp;
+    mp_uint *rp = tp + qn;
+
+    if (mp_div_pre(xp + z, xn - z, &ctx->powers[k], qp, rp + z)) {
+        return NULL;
+    }
+
+    mp_uint_copy(xp, z, rp);
+
+    char *mid = mp_to_string_10_rec(first, qp, qn, k - 1, half, rp + pn, ctx);
+
+    if (!mid) {
+        return NULL;
+    }
+
+    // a zero quotient writes nothing when unpadded, and then neither may r
+    return mp_to_string_10_rec(mid, rp, pn, k - 1,
+                               mid == first ? half : MP_DEC_DIGITS << k,
+                               rp + pn, ctx);
+}
+
+static struct mp_to_string_result mp_to_string_10(
+    char *first, char *last, const mp_uint *ap, mp_size an)
+{
+    _Static_assert(MP_TO_STRING_DC_THRESHOLD >= 2, "threshold too small");
+
+    mp_size bits = mp_bit_width(ap, an);
+
+    if (!bits) {
+        return mp_to_string_zero(first, last);
+    }
+
+    an = (bits + MP_UINT_WIDTH - 1) / MP_UINT_WIDTH;
+
+    // 1234 / 4096 is just above log10(2)
+    mp_size max_digits = bits * 1234 / 4096 + 1;
+    struct mp_allocator *alloc = mp_get_default_allocator();
+    struct mp_to_string_10_ctx ctx;
+
+    ctx.buf = NULL;
+    ctx.shift = mp_uint_countl_zero(MP_DEC_BASE);
+    ctx.base = MP_DEC_BASE << ctx.shift;
+    ctx.inv = mp_uint_inv(ctx.base);
+
+    // p_k^2 > a once 2 |p_k| - 2 >= an
+    mp_size pn = 2 * an + 2 + MP_UINT_WIDTH;
+    mp_uint *pp = mp_allocate_uint(alloc, pn);
+
+    if (!pp) {
+        return mp_to_string_no_mem(first);
+    }
+
+    mp_size k = 0;
+    mp_size tn = an;
+    mp_uint *p = pp;
+
+    p[0] = MP_DEC_BASE;
+    ctx.sizes[0] = 1;
+    ctx.zeros[0] = 0;
+
+    while (2 * ctx.sizes[k] - 1 <= an) {
+        mp_size n = ctx.sizes[k];
+
+        mp_sqr_with_alloc(p, n, p + n, alloc);
+        p += n;
+        n *= 2;
+        n -= !p[n - 1];
+
+        mp_size z = 0;
+
+        while (!p[z]) {
+            ++z;
+        }
+
+        ++k;
+        ctx.sizes[k] = n;
+        ctx.zeros[k] = z;
+        tn += 2 * n + 1;
+    }
+
+    mp_size levels = 1;
+    enum mp_errc ec = MP_ERRC_OK;
+
+    for (p = pp + 1; levels <= k; p += ctx.sizes[levels++]) {
+        mp_size z = ctx.zeros[levels];
+
+        ec = mp_divisor_construct(&ctx.powers[levels], p + z,
+                                  ctx.sizes[levels] - z, alloc);
+
+        if (ec) {
+            break;
+        }
+    }
+
+    mp_size outn = last - first < max_digits ? max_digits : 0;
+    mp_uint *tp = NULL;
+    char *out = NULL;
+
+    ctx.bufn = MP_DEC_DIGITS * (MP_TO_STRING_DC_THRESHOLD +
+                                MP_TO_STRING_DC_THRESHOLD / 32 + 2);
+
+    if (!ec) {
+        tp = mp_allocate_uint(alloc, tn);
+        ctx.buf = mp_allocate_char(alloc, ctx.bufn + outn);
+        out = outn ? ctx.buf + ctx.bufn : first;
+        ec = tp && ctx.buf ? MP_ERRC_OK : MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    char *end = NULL;
+
+    if (!ec) {
+        mp_uint_copy(ap, an, tp);
+        end = mp_to_string_10_rec(out, tp, an, k, 0, tp + an, &ctx);
+    }
+
+    if (end && outn) {
+        if (end - out <= last - first) {
+            memcpy(first, out, end - out);
+            end = first + (end - out);
+        } else {
+            end = NULL;
+        }
+    }
+
+    if (tp) {
+        mp_deallocate_uint(alloc, tp, tn);
+    }
+
+    if (ctx.buf) {
+        mp_deallocate_char(alloc, ctx.buf, ctx.bufn + outn);
+    }
+
+    while (--levels) {
+        mp_divisor_destruct(&ctx.powers[levels]);
+    }
+
+    mp_deallocate_uint(alloc, pp, pn);
+    return end ? mp_to_string_ok(end) : mp_to_string_no_mem(first);
+}
+
+// Other bases divide by B = b^k, the largest power of b in a limb, and write
+// k digits for each remainder, so that a pass over a gives k digits
+
+static struct mp_to_string_result mp_to_string_n(
+    char *first, char *last, const mp_uint *ap, mp_size an, int base)
+{
+    mp_size bits = mp_bit_width(ap, an);
+
+    if (!bits) {
+        return mp_to_string_zero(first, last);
+    }
+
+    mp_size tn = (bits + MP_UINT_WIDTH - 1) / MP_UINT_WIDTH;
+    mp_uint big = base;
+    mp_size k = 1;
+
+    while (big <= MP_UINT_MAX / base) {
+        big *= base;
+        ++k;
+    }
+
+    // B >= 2^(|B| - 1), so a has at most bits / (|B| - 1) + 1 digits in B
+    mp_size bufn = (bits / (mp_uint_bit_width(big) - 1) + 1) * k;
+    struct mp_allocator *alloc = mp_get_default_allocator();
+    mp_uint *tp = mp_allocate_uint(alloc, tn);
+    char *buf = mp_allocate_char(alloc, bufn);
+    struct mp_to_string_result result = mp_to_string_no_mem(first);
+
+    if (tp && buf) {
+        mp_size shift = mp_uint_countl_zero(big);
+        mp_uint inv = mp_uint_inv(big << shift);
+        char *end = buf + bufn;
+        char *p = end;
+
+        mp_uint_copy(ap, tn, tp);
+
+        for (an = tn; an;) {
+            mp_uint r = mp_div_uint_norm(tp, an, big << shift, shift, inv, tp);
+
+            an -= !tp[an - 1];
+
+            for (mp_size i = 0; i < k; i++) {
+                *--p = mp_digit_chars[r % base];
+                r /= base;
+            }
+        }
+
+        while (*p == '0') {
+            ++p;
+        }
+
+        if (end - p <= last - first) {
+            memcpy(first, p, end - p);
+            result = mp_to_string_ok(first + (end - p));
+        }
+    }
+
+    if (tp) {
+        mp_deallocate_uint(alloc, tp, tn);
+    }
+
+    if (buf) {
+        mp_deallocate_char(alloc, buf, bufn);
+    }
+
+    return result;
+}
+
+struct mp_to_string_result mp_to_string(
+    char *first, char *last, const mp_uint *ap, mp_size an, int base)
+{
+    MP_EXPECTS(base >= 2 && base <= 36);
+
+    if (!an) {
+        return mp_to_string_zero(first, last);
+    }
+
+    switch (base) {
+    case 2:
+    case 4:
+    case 8:
+    case 16:
+    case 32:
+        return mp_to_string_pow2(
+            first, last, ap, an, mp_uint_countr_zero(base));
+    case 10:
+        return mp_to_string_10(first, last, ap, an);
+    default:
+        return mp_to_string_n(first, last, ap, an, base);
+    }
+}
+
+// Parsing in base b takes the digits in chunks of k, the most that fit a limb
+// as a number in base B = b^k. A string of up to 2^(j + 1) chunks is split
+// into its last 2^j chunks and the rest, which are parsed in turn and joined
+// as hi P_j + lo, with P_j = B^(2^j) squared up from B. The products at the
+// top dominate, so the cost is O(M(n) log n). Strings of up to
+// MP_FROM_STRING_DC_THRESHOLD chunks are parsed a chunk at a time by Horner's
+// rule. As for output, the zero low limbs of the powers are left out of the
+// products.
+
+// The digits of bases 10 and 16 are checked and packed eight at a time in a
+// 64-bit word, the first digit in the low byte. Range checks run on the low
+// seven bits of each byte, so that no carry crosses into the next byte.
+
+#define MP_SWAR_BYTES(x) ((uint64_t)(x) * 0x0101010101010101u)
+
+static inline uint64_t mp_swar_load(const char *s)
+{
+    uint64_t x;
+
+    memcpy(&x, s, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+static inline uint64_t mp_swar_in_range(uint64_t t, unsigned lo, unsigned hi)
+{
+    return (t + MP_SWAR_BYTES(0x80 - lo)) & ~(t + MP_SWAR_BYTES(0x7f - hi));
+}
+
+// The top bit of each byte of x that is a digit
+
+static inline uint64_t mp_swar_digits(uint64_t x, mp_bool hex)
+{
+    uint64_t t = x & MP_SWAR_BYTES(0x7f);
+    uint64_t d = mp_swar_in_range(t, '0', '9');
+
+    if (hex) {
+        d |= mp_swar_in_range(t | MP_SWAR_BYTES(0x20), 'a', 'f');
+    }
+
+    return d & ~x & MP_SWAR_BYTES(0x80);
+}
+
+// Pairs, then quads, then the two halves are joined by a multiply-add each
+
+static inline uint64_t mp_swar_dec_8(uint64_t x)
+{
+    x -= MP_SWAR_BYTES('0');
+    x = (x * 10 + (x >> 8)) & 0x00ff00ff00ff00ffu;
+    x = (x * 100 + (x >> 16)) & 0x0000ffff0000ffffu;
+    return (x * 10000 + (x >> 32)) & 0xffffffffu;
+}
+
+static inline uint64_t mp_swar_hex_8(uint64_t x)
+{
+    x = (x & MP_SWAR_BYTES(0x0f)) + (x >> 6 & MP_SWAR_BYTES(0x01)) * 9;
+    x = (x << 4 | x >> 8) & 0x00ff00ff00ff00ffu;
+    x = (x << 8 | x >> 16) & 0x0000ffff0000ffffu;
+    return (x << 16 | x >> 32) & 0xffffffffu;
+}
+
+static mp_size mp_scan_digits(const char *s, mp_size n, mp_bool hex)
+{
+    mp_size i = 0;
+
+    while (i + 8 <= n &&
+           mp_swar_digits(mp_swar_load(s + i), hex) == MP_SWAR_BYTES(0x80)) {
+        i += 8;
+    }
+
+    while (i < n && mp_digit_value(s[i]) < (hex ? 16u : 10u)) {
+        ++i;
+    }
+
+    return i;
+}
+
+mp_size mp_scan_10_generic(const char *s, mp_size n)
+{
+    return mp_scan_digits(s, n, mp_false);
+}
+
+mp_size mp_scan_16_generic(const char *s, mp_size n)
+{
+    return mp_scan_digits(s, n, mp_true);
+}
+
+// MP_DEC_DIGITS digits
+
+static inline mp_uint mp_dec_chunk(const char *s)
+{
+#if MP_UINT_WIDTH == 64
+    uint64_t hi = mp_swar_dec_8(mp_swar_load(s));
+    uint64_t lo = mp_swar_dec_8(mp_swar_load(s + 8));
+    unsigned tail = (s[16] - '0') * 100 + (s[17] - '0') * 10 + (s[18] - '0');
+
+    return hi * 100000000000u + lo * 1000 + tail;
+#else
+    return mp_swar_dec_8(mp_swar_load(s)) * 10 + (s[8] - '0');
+#endif
+}
+
+// 2 MP_UINT_WIDTH / 8 hex digits
+
+static inline mp_uint mp_hex_chunk(const char *s)
+{
+#if MP_UINT_WIDTH == 64
+    return mp_swar_hex_8(mp_swar_load(s)) << 32 |
+           mp_swar_hex_8(mp_swar_load(s + 8));
+#else
+    return mp_swar_hex_8(mp_swar_load(s));
+#endif
+}
+
+struct mp_from_string_ctx {
+    const mp_uint *powers[MP_UINT_WIDTH];
+    mp_size sizes[MP_UINT_WIDTH];
+    mp_size zeros[MP_UINT_WIDTH];
+    mp_uint big;
+    mp_size digits;
+    unsigned base;
+    struct mp_allocator *alloc;
+};
+
+// Writes the value of the n digits at s to r, which takes a limb for each
+// chunk, and returns its size
+
+static mp_size mp_from_string_basecase(const char *s, mp_size n, mp_uint *rp,
+                                       const struct mp_from_string_ctx *ctx)
+{
+    mp_size rn = 0;
+    mp_size m = (n - 1) % ctx->digits + 1;
+
+    for (const char *end = s + n; s != end; m = ctx->digits) {
+        mp_uint c = 0;
+
+        if (ctx->base == 10 && m == MP_DEC_DIGITS) {
+            c = mp_dec_chunk(s);
+            s += m;
+        } else {
+            for (mp_size i = 0; i < m; i++) {
+                c = c * ctx->base + mp_digit_value(*s++);
+            }
+        }
+
+        if (rn) {
+            rp[rn] = mp_mul_uint(rp, rn, ctx->big, rp);
+            rp[rn] += mp_add_uint(rp, rn, c, rp);
+            rn += !!rp[rn];
+        } else if (c) {
+            rp[rn++] = c;
+        }
+    }
+
+    return rn;
+}
+
+// As mp_from_string_basecase, for n digits of at most 2^(k + 1) chunks. t
+// takes 3 2^k limbs.
+
+static mp_size mp_from_string_rec(const char *s, mp_size n, mp_size k,
+                                  mp_uint *rp, mp_uint *tp,
+                                  const struct mp_from_string_ctx *ctx)
+{
+    if (n <= ctx->digits * MP_FROM_STRING_DC_THRESHOLD) {
+        return mp_from_string_basecase(s, n, rp, ctx);
+    }
+
+    mp_size lo = ctx->digits << k;
+
+    while (n <= lo) {
+        lo /= 2;
+        --k;
+    }
+
+    mp_size hi = n - lo;
+    mp_size hc = (hi - 1) / ctx->digits + 1;
+    mp_size pn = ctx->sizes[k] - ctx->zeros[k];
+    mp_size z = ctx->zeros[k];
+    mp_size ln = mp_from_string_rec(s + hi, lo, k - 1, rp, tp, ctx);
+    mp_size hn = mp_from_string_rec(s, hi, k - 1, tp, tp + hc, ctx);
+
+    if (!hn) {
+        return ln;
+    }
+
+    // hi P_j + lo, with lo < P_j
+    mp_uint *mp = tp + hc;
+
+    if (hn >= pn) {
+        mp_mul_with_alloc(tp, hn, ctx->powers[k], pn, mp, ctx->alloc);
+    } else {
+        mp_mul_with_alloc(ctx->powers[k], pn, tp, hn, mp, ctx->alloc);
+    }
+
+    mp_uint_zero(rp + ln, z + pn - ln);
+    mp_add(mp, hn + pn, rp + z, pn, rp + z);
+
+    mp_size rn = z + pn + hn;
+    return rn - !rp[rn - 1];
+}
+
+static struct mp_from_string_result mp_from_string_n(
+    const char *first, const char *last, mp_uint *ap, mp_size an, int base)
+{
+    _Static_assert(MP_FROM_STRING_DC_THRESHOLD >= 2, "threshold too small");
+
+    const char *end = first;
+
+    if (base == 10) {
+        end += MP_KERNEL(scan_10)(first, last - first);
+    } else {
+        while (end != last && mp_digit_value(*end) < (unsigned)base) {
+            ++end;
+        }
+    }
+
+    if (end == first) {
+        return mp_from_string_error(MP_ERRC_INVALID_ARGUMENT, first, 0);
+    }
+
+    while (first != end && *first == '0') {
+        ++first;
+    }
+
+    struct mp_from_string_ctx ctx;
+
+    ctx.base = base;
+    ctx.big = base;
+    ctx.digits = 1;
+    ctx.alloc = mp_get_default_allocator();
+
+    while (ctx.big <= MP_UINT_MAX / ctx.base) {
+        ctx.big *= ctx.base;
+        ++ctx.digits;
+    }
+
+    mp_size n = end - first;
+    mp_size cn = (n + ctx.digits - 1) / ctx.digits;
+    mp_size k = 0;
+
+    if (cn <= MP_FROM_STRING_DC_THRESHOLD && cn <= an) {
+        return mp_from_string_ok(
+            end, mp_from_string_basecase(first, n, ap, &ctx));
+    }
+
+    while ((mp_size)2 << k < cn) {
+        ++k;
+    }
+
+    // the powers take fewer than 2^(k + 1) limbs and the value cn
+    mp_size pn = (mp_size)2 << k;
+    mp_size tn = (mp_size)3 << k;
+    mp_size rn = an < cn ? cn : 0;
+    mp_uint *pp = mp_allocate_uint(ctx.alloc, pn + tn + rn);
+
+    if (!pp) {
+        return mp_from_string_error(MP_ERRC_NOT_ENOUGH_MEMORY, first, 0);
+    }
+
+    mp_uint *p = pp;
+
+    p[0] = ctx.big;
+    ctx.powers[0] = p;
+    ctx.sizes[0] = 1;
+    ctx.zeros[0] = 0;
+
+    for (mp_size j = 0; j < k; j++) {
+        mp_size m = ctx.sizes[j];
+
+        mp_sqr_with_alloc(p, m, p + m, ctx.alloc);
+        p += m;
+        m *= 2;
+        m -= !p[m - 1];
+
+        mp_size z = 0;
+
+        while (!p[z]) {
+            ++z;
+        }
+
+        ctx.powers[j + 1] = p + z;
+        ctx.sizes[j + 1] = m;
+        ctx.zeros[j + 1] = z;
+    }
+
+    mp_uint *tp = pp + pn;
+    mp_uint *rp = rn ? tp + tn : ap;
+    mp_size size = mp_from_string_rec(first, n, k, rp, tp, &ctx);
+    enum mp_errc ec = MP_ERRC_OK;
+
+    if (size > an) {
+        ec = MP_ERRC_VALUE_TOO_LARGE;
+    } else if (rn) {
+        mp_uint_copy(rp, size, ap);
+    }
+
+    mp_deallocate_uint(ctx.alloc, pp, pn + tn + rn);
+    return mp_from_string_error(ec, end, size);
+}
+
+static struct mp_from_string_result mp_from_string_10(
+    const char *first, const char *last, mp_uint *ap, mp_size an)
+{
+    return mp_from_string_n(first, last, ap, an, 10);
+}
+
+// Hex digits map to limbs directly, a chunk at a time from the end
+
+static struct mp_from_string_result mp_from_string_16(
+    const char *first, const char *last, mp_uint *ap, mp_size an)
+{
+    const char *end = first + MP_KERNEL(scan_16)(first, last - first);
+
+    if (end == first) {
+        return mp_from_string_error(MP_ERRC_INVALID_ARGUMENT, first, 0);
+    }
+
+    while (first != end && *first == '0') {
+        ++first;
+    }
+
+    mp_size digits = MP_UINT_WIDTH / 4;
+    mp_size n = end - first;
+    mp_size cn = (n + digits - 1) / digits;
+
+    if (cn > an) {
+        return mp_from_string_error(MP_ERRC_VALUE_TOO_LARGE, end, cn);
+    }
+
+    const char *s = end;
+
+    for (mp_size i = 0; i < n / digits; i++) {
+        s -= digits;
+        ap[i] = mp_hex_chunk(s);
+    }
+
+    if (n % digits) {
+        mp_uint c = 0;
+
+        while (first != s) {
+            c = c << 4 | mp_digit_value(*first++);
+        }
+
+        ap[cn - 1] = c;
+    }
+
+    return mp_from_string_ok(end, cn);
+}
+
+// The other bases 2^b take the digits from the end, b bits at a time
+
+static struct mp_from_string_result mp_from_string_pow2(
+    const char *first, const char *last, mp_uint *ap, mp_size an, mp_size b)
+{
+    const char *end = first;
+
+    while (end != last && mp_digit_value(*end) >> b == 0) {
+        ++end;
+    }
+
+    if (end == first) {
+        return mp_from_string_error(MP_ERRC_INVALID_ARGUMENT, first, 0);
+    }
+
+    while (first != end && *first == '0') {
+        ++first;
+    }
+
+    if (first == end) {
+        return mp_from_string_ok(end, 0);
+    }
+
+    mp_size top = mp_uint_bit_width(mp_digit_value(*first));
+    mp_size bits = (end - first - 1) * b + top;
+    mp_size cn = (bits + MP_UINT_WIDTH - 1) / MP_UINT_WIDTH;
+
+    if (cn > an) {
+        return mp_from_string_error(MP_ERRC_VALUE_TOO_LARGE, end, cn);
+    }
+
+    mp_uint c = 0;
+    mp_size have = 0;
+    mp_size i = 0;
+
+    for (const char *s = end; s != first;) {
+        mp_uint d = mp_digit_value(*--s);
+
+        c |= d << have;
+        have += b;
+
+        if (have >= MP_UINT_WIDTH) {
+            ap[i++] = c;
+            have -= MP_UINT_WIDTH;
+            c = have ? d >> (b - have) : 0;
+        }
+    }
+
+    if (i < cn) {
+        ap[i] = c;
+    }
+
+    return mp_from_string_ok(end, cn);
+}
 
 struct mp_from_string_result mp_from_string(
     const char *first, const char *last, mp_uint *ap, mp_size an, int base)
@@ -599,9 +3657,11 @@ struct mp_from_string_result mp_from_string(
 
     switch (base) {
     case 2:
-        return mp_from_string_2(first, last, ap, an);
+    case 4:
     case 8:
-        return mp_from_string_8(first, last, ap, an);
+    case 32:
+        return mp_from_string_pow2(
+            first, last, ap, an, mp_uint_countr_zero(base));
     case 10:
         return mp_from_string_10(first, last, ap, an);
     case 16:
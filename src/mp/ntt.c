@@ -0,0 +1,465 @@
+#include <mp/config.h>
+#include <mp/memory.h>
+#include <mp/mp.h>
+#include "./util.h"
+
+// Three-prime number theoretic transform multiplication. Every limb is a
+// coefficient, and the cyclic convolution of length L = 2^k >= an + bn - 1 is
+// computed modulo three primes p = c 2^57 + 1 just above 2^63. The
+// coefficients of the product are below min(an, bn) B^2, far below
+// p1 p2 p3 > 2^189, so they are recovered exactly by the CRT.
+//
+// The primes are normalized, so products are reduced with mp_uint_div_inv
+// and the precomputed inverse of p.
+
+_Static_assert(MP_UINT_WIDTH == 64, "mp: ntt needs 64 bit limbs");
+
+#define MP_NTT_PRIME_COUNT 3
+#define MP_NTT_MAX_LOG 57
+
+struct mp_ntt_prime {
+    mp_uint p;
+    mp_uint v;
+};
+
+static const mp_uint mp_ntt_primes[MP_NTT_PRIME_COUNT] = {
+    0x8e00000000000001,
+    0x9600000000000001,
+    0xbe00000000000001,
+};
+
+static const mp_uint mp_ntt_generators[MP_NTT_PRIME_COUNT] = {3, 7, 3};
+
+// a + b - p, without overflowing when a + b >= B
+
+static inline mp_uint mp_ntt_add(mp_uint a, mp_uint b, mp_uint p)
+{
+    mp_uint r = a - (p - b);
+
+    if (a < p - b) {
+        r += p;
+    }
+
+    return r;
+}
+
+static inline mp_uint mp_ntt_sub(mp_uint a, mp_uint b, mp_uint p)
+{
+    mp_uint r = a - b;
+
+    if (a < b) {
+        r += p;
+    }
+
+    return r;
+}
+
+static inline mp_uint mp_ntt_mul(
+    mp_uint a, mp_uint b, const struct mp_ntt_prime *prime)
+{
+    mp_uint hi, lo, r;
+
+    lo = mp_uint_mul(a, b, &hi);
+    mp_uint_div_inv(hi, lo, prime->p, prime->v, &r);
+    return r;
+}
+
+static void mp_ntt_init_primes(struct mp_ntt_prime *primes)
+{
+    for (mp_size i = 0; i < MP_NTT_PRIME_COUNT; i++) {
+        primes[i].p = mp_ntt_primes[i];
+        primes[i].v = mp_uint_inv(mp_ntt_primes[i]);
+    }
+}
+
+static mp_uint mp_ntt_pow(
+    mp_uint a, mp_uint e, const struct mp_ntt_prime *prime)
+{
+    mp_uint r = 1;
+
+    while (e) {
+        if (e & 1) {
+            r = mp_ntt_mul(r, a, prime);
+        }
+
+        a = mp_ntt_mul(a, a, prime);
+        e >>= 1;
+    }
+
+    return r;
+}
+
+static inline mp_uint mp_ntt_reduce(mp_uint a, mp_uint p)
+{
+    return a >= p ? a - p : a;
+}
+
+// w[j] = g^((p - 1) j / L), for 0 <= j < L / 2
+
+static void mp_ntt_roots(mp_uint g, mp_size k, const struct mp_ntt_prime *prime,
+                         mp_uint *wp)
+{
+    mp_size half = (mp_size)1 << k >> 1;
+    mp_uint w = mp_ntt_pow(g, (prime->p - 1) >> k, prime);
+
+    wp[0] = 1;
+
+    for (mp_size j = 1; j < half; j++) {
+        wp[j] = mp_ntt_mul(wp[j - 1], w, prime);
+    }
+}
+
+// Forward transform, decimation in frequency. Leaves the output in bit
+// reversed order.
+
+static void mp_ntt_forward(mp_uint *xp, mp_size k, const mp_uint *wp,
+                           const struct mp_ntt_prime *prime)
+{
+    mp_size size = (mp_size)1 << k;
+    mp_uint p = prime->p;
+
+    for (mp_size len = size / 2, step = 1; len; len /= 2, step *= 2) {
+        for (mp_size first = 0; first < size; first += 2 * len) {
+            mp_uint *x0 = xp + first;
+            mp_uint *x1 = x0 + len;
+
+            for (mp_size j = 0; j < len; j++) {
+                mp_uint a = x0[j];
+                mp_uint b = x1[j];
+
+                x0[j] = mp_ntt_add(a, b, p);
+                x1[j] = mp_ntt_mul(mp_ntt_sub(a, b, p), wp[j * step], prime);
+            }
+        }
+    }
+}
+
+// Inverse transform, decimation in time. Takes its input in bit reversed
+// order and leaves the output scaled by L. The inverse roots are
+// w^-j = -w^(L / 2 - j).
+
+static void mp_ntt_inverse(mp_uint *xp, mp_size k, const mp_uint *wp,
+                           const struct mp_ntt_prime *prime)
+{
+    mp_size size = (mp_size)1 << k;
+    mp_size half = size / 2;
+    mp_uint p = prime->p;
+
+    for (mp_size len = 1, step = half; len < size; len *= 2, step /= 2) {
+        for (mp_size first = 0; first < size; first += 2 * len) {
+            mp_uint *x0 = xp + first;
+            mp_uint *x1 = x0 + len;
+            mp_uint a = x0[0];
+            mp_uint b = x1[0];
+
+            x0[0] = mp_ntt_add(a, b, p);
+            x1[0] = mp_ntt_sub(a, b, p);
+
+            for (mp_size j = 1; j < len; j++) {
+                a = x0[j];
+                b = mp_ntt_mul(x1[j], wp[half - j * step], prime);
+                x0[j] = mp_ntt_sub(a, b, p);
+                x1[j] = mp_ntt_add(a, b, p);
+            }
+        }
+    }
+}
+
+static void mp_ntt_load(const mp_uint *ap, mp_size an, mp_size k, mp_uint p,
+                        mp_uint *xp)
+{
+    mp_size size = (mp_size)1 << k;
+
+    for (mp_size i = 0; i < an; i++) {
+        xp[i] = mp_ntt_reduce(ap[i], p);
+    }
+
+    mp_uint_zero(xp + an, size - an);
+}
+
+// x = a b / L mod p, as the cyclic convolution of a and b
+
+static void mp_ntt_convolve(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                            mp_size bn, mp_size k, mp_uint g,
+                            const struct mp_ntt_prime *prime, mp_uint *xp,
+                            mp_uint *yp, mp_uint *wp)
+{
+    mp_size size = (mp_size)1 << k;
+    mp_uint p = prime->p;
+    mp_uint scale = mp_ntt_pow(size, p - 2, prime);
+
+    mp_ntt_roots(g, k, prime, wp);
+    mp_ntt_load(ap, an, k, p, xp);
+    mp_ntt_forward(xp, k, wp, prime);
+
+    if (ap == bp && an == bn) {
+        for (mp_size i = 0; i < size; i++) {
+            xp[i] = mp_ntt_mul(mp_ntt_mul(xp[i], xp[i], prime), scale, prime);
+        }
+    } else {
+        mp_ntt_load(bp, bn, k, p, yp);
+        mp_ntt_forward(yp, k, wp, prime);
+
+        for (mp_size i = 0; i < size; i++) {
+            xp[i] = mp_ntt_mul(mp_ntt_mul(xp[i], yp[i], prime), scale, prime);
+        }
+    }
+
+    mp_ntt_inverse(xp, k, wp, prime);
+}
+
+// Garner's algorithm, c = x1 + p1 (u2 + p2 u3), with the coefficients first,
+// first + 1, ... added into r at their limb offsets. The last coefficient
+// carries into the remaining rn - count limbs.
+
+static void mp_ntt_recompose(mp_uint *const xps[MP_NTT_PRIME_COUNT],
+                             const struct mp_ntt_prime *primes, mp_size first,
+                             mp_size count, mp_uint *rp, mp_size rn)
+{
+    MP_EXPECTS(rn > count && rn <= count + 2);
+
+    const struct mp_ntt_prime *q2 = &primes[1];
+    const struct mp_ntt_prime *q3 = &primes[2];
+    mp_uint p1 = primes[0].p;
+    mp_uint p2 = q2->p;
+    mp_uint p3 = q3->p;
+    mp_uint i12 = mp_ntt_pow(mp_ntt_reduce(p1, p2), p2 - 2, q2);
+    mp_uint i13 = mp_ntt_pow(mp_ntt_reduce(p1, p3), p3 - 2, q3);
+    mp_uint i23 = mp_ntt_pow(mp_ntt_reduce(p2, p3), p3 - 2, q3);
+    mp_uint p12hi, p12lo = mp_uint_mul(p1, p2, &p12hi);
+    mp_uint c0 = 0, c1 = 0, c2 = 0;
+
+    for (mp_size i = 0; i < count; i++) {
+        mp_size j = first + i;
+        mp_uint x1 = xps[0][j];
+        mp_uint u2 =
+            mp_ntt_mul(mp_ntt_sub(xps[1][j], mp_ntt_reduce(x1, p2), p2), i12, q2);
+        mp_uint u3 =
+            mp_ntt_mul(mp_ntt_sub(xps[2][j], mp_ntt_reduce(x1, p3), p3), i13, q3);
+
+        u3 = mp_ntt_mul(mp_ntt_sub(u3, mp_ntt_reduce(u2, p3), p3), i23, q3);
+
+        // c += x1 + p1 u2 + p1 p2 u3
+        mp_uint t0, t1, t2, s0, s1, s2;
+
+        t0 = mp_uint_mul(u3, p12lo, &t1);
+        s1 = mp_uint_mul(u3, p12hi, &t2);
+        t1 += s1;
+        t2 += t1 < s1;
+
+        s0 = mp_uint_mul(u2, p1, &s1);
+        t0 += s0;
+        s1 += t0 < s0;
+        t1 += s1;
+        t2 += t1 < s1;
+
+        t0 += x1;
+        s2 = t0 < x1;
+        t1 += s2;
+        t2 += t1 < s2;
+
+        c0 += t0;
+        s2 = c0 < t0;
+        c1 += s2;
+        s2 = c1 < s2;
+        c1 += t1;
+        s2 += c1 < t1;
+        c2 += t2 + s2;
+
+        rp[i] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+
+    rp[count] = c0;
+
+    if (rn > count + 1) {
+        rp[count + 1] = c1;
+    } else {
+        MP_ENSURES(!c1);
+    }
+}
+
+// Computes the cyclic convolution of a and b of length 2^k, and recomposes
+// count of its coefficients from first into the rn limbs of r.
+
+static enum mp_errc mp_ntt_run(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                               mp_size bn, mp_size n, mp_size first,
+                               mp_size count, mp_uint *rp, mp_size rn,
+                               struct mp_allocator *alloc)
+{
+    mp_size k = 1;
+
+    while (((mp_size)1 << k) < n) {
+        ++k;
+    }
+
+    if (k > MP_NTT_MAX_LOG) {
+        return MP_ERRC_VALUE_TOO_LARGE;
+    }
+
+    mp_size size = (mp_size)1 << k;
+    mp_size tn = (MP_NTT_PRIME_COUNT + 1) * size + size / 2;
+    mp_uint *tp = mp_allocate_uint(alloc, tn);
+
+    if (!tp) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_uint *xps[MP_NTT_PRIME_COUNT];
+    mp_uint *yp = tp + MP_NTT_PRIME_COUNT * size;
+    mp_uint *wp = yp + size;
+    struct mp_ntt_prime primes[MP_NTT_PRIME_COUNT];
+
+    mp_ntt_init_primes(primes);
+
+    for (mp_size i = 0; i < MP_NTT_PRIME_COUNT; i++) {
+        xps[i] = tp + i * size;
+
+        mp_ntt_convolve(ap, an, bp, bn, k, mp_ntt_generators[i], &primes[i],
+                        xps[i], yp, wp);
+    }
+
+    mp_ntt_recompose(xps, primes, first, count, rp, rn);
+
+    mp_deallocate_uint(alloc, tp, tn);
+    return MP_ERRC_OK;
+}
+
+enum mp_errc mp_mul_ntt(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                        mp_size bn, mp_uint *rp, struct mp_allocator *alloc)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
+
+    return mp_ntt_run(
+        ap, an, bp, bn, an + bn - 1, 0, an + bn - 1, rp, an + bn, alloc);
+}
+
+// With a convolution of length L >= an, the columns at and above L wrap
+// around onto columns below bn - 1, and leave the middle ones intact.
+
+enum mp_errc mp_mulmid_ntt(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                           mp_size bn, mp_uint *rp, struct mp_allocator *alloc)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
+
+    mp_size m = an - bn + 1;
+
+    return mp_ntt_run(ap, an, bp, bn, an, bn - 1, m, rp, m + 2, alloc);
+}
+
+// A prepared operand b keeps, for each prime, the transform of b scaled by
+// 1 / L and the roots for L = 2^k >= 2 bn. Products by it are computed in
+// blocks of L - bn + 1 limbs of the other operand, so they need only one
+// forward and one inverse transform per block and prime.
+
+static mp_size mp_ntt_prepared_log(mp_size bn)
+{
+    mp_size k = 1;
+
+    while (((mp_size)1 << k) < 2 * bn) {
+        ++k;
+    }
+
+    return k;
+}
+
+// Returns 0 when bn is too large for the primes
+
+mp_size mp_ntt_prepared_size(mp_size bn)
+{
+    mp_size k = mp_ntt_prepared_log(bn);
+
+    if (k > MP_NTT_MAX_LOG) {
+        return 0;
+    }
+
+    mp_size size = (mp_size)1 << k;
+
+    return MP_NTT_PRIME_COUNT * (size + size / 2);
+}
+
+void mp_ntt_prepare(const mp_uint *bp, mp_size bn, mp_uint *data)
+{
+    mp_size k = mp_ntt_prepared_log(bn);
+    mp_size size = (mp_size)1 << k;
+    struct mp_ntt_prime primes[MP_NTT_PRIME_COUNT];
+
+    mp_ntt_init_primes(primes);
+
+    for (mp_size i = 0; i < MP_NTT_PRIME_COUNT; i++) {
+        const struct mp_ntt_prime *prime = &primes[i];
+        mp_uint *yp = data + i * size;
+        mp_uint *wp = data + MP_NTT_PRIME_COUNT * size + i * (size / 2);
+        mp_uint scale = mp_ntt_pow(size, prime->p - 2, prime);
+
+        mp_ntt_roots(mp_ntt_generators[i], k, prime, wp);
+        mp_ntt_load(bp, bn, k, prime->p, yp);
+        mp_ntt_forward(yp, k, wp, prime);
+
+        for (mp_size j = 0; j < size; j++) {
+            yp[j] = mp_ntt_mul(yp[j], scale, prime);
+        }
+    }
+}
+
+enum mp_errc mp_mul_ntt_prepared(const mp_uint *ap, mp_size an, mp_size bn,
+                                 const mp_uint *data, mp_uint *rp,
+                                 struct mp_allocator *alloc)
+{
+    MP_EXPECTS(an);
+    MP_EXPECTS(bn);
+
+    mp_size k = mp_ntt_prepared_log(bn);
+    mp_size size = (mp_size)1 << k;
+    mp_size s = size - bn + 1;
+    mp_size tn = MP_NTT_PRIME_COUNT * size + s + bn;
+    mp_uint *tp = mp_allocate_uint(alloc, tn);
+
+    if (!tp) {
+        return MP_ERRC_NOT_ENOUGH_MEMORY;
+    }
+
+    mp_uint *xps[MP_NTT_PRIME_COUNT];
+    mp_uint *up = tp + MP_NTT_PRIME_COUNT * size;
+    struct mp_ntt_prime primes[MP_NTT_PRIME_COUNT];
+
+    mp_ntt_init_primes(primes);
+
+    for (mp_size first = 0; first < an; first += s) {
+        mp_size count = an - first < s ? an - first : s;
+        mp_uint *dest = first ? up : rp;
+
+        for (mp_size i = 0; i < MP_NTT_PRIME_COUNT; i++) {
+            const struct mp_ntt_prime *prime = &primes[i];
+            const mp_uint *yp = data + i * size;
+            const mp_uint *wp = data + MP_NTT_PRIME_COUNT * size + i * (size / 2);
+            mp_uint *xp = tp + i * size;
+
+            xps[i] = xp;
+            mp_ntt_load(ap + first, count, k, prime->p, xp);
+            mp_ntt_forward(xp, k, wp, prime);
+
+            for (mp_size j = 0; j < size; j++) {
+                xp[j] = mp_ntt_mul(xp[j], yp[j], prime);
+            }
+
+            mp_ntt_inverse(xp, k, wp, prime);
+        }
+
+        mp_ntt_recompose(xps, primes, 0, count + bn - 1, dest, count + bn);
+
+        if (first) {
+            mp_uint c = mp_add_n(rp + first, up, bn, rp + first);
+
+            mp_uint_copy(up + bn, count, rp + first + bn);
+            mp_add_uint(rp + first + bn, count, c, rp + first + bn);
+        }
+    }
+
+    mp_deallocate_uint(alloc, tp, tn);
+    return MP_ERRC_OK;
+}
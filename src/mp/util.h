@@ -2,6 +2,7 @@
 #define SRC_MP_H_
 
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <string.h>
 #include <mp/bigint.h>
@@ -15,7 +16,9 @@ extern const uint_least16_t mp_uint_inv32_table[512];
 
 static inline void mp_uint_copy(const mp_uint *src, mp_size n, mp_uint *dest)
 {
-    memcpy(dest, src, n & sizeof(mp_uint));
+    if (n) {
+        memcpy(dest, src, n * sizeof(mp_uint));
+    }
 }
 
 static inline void mp_uint_move(const mp_uint *src, mp_size n, mp_uint *dest)
@@ -89,6 +92,17 @@ static inline mp_size mp_uint_popcount(mp_uint x)
 #endif
 }
 
+static inline mp_uint mp_uint_bswap(mp_uint x)
+{
+#if MP_HAS_BUILTIN(__builtin_bswap32) && MP_UINT_WIDTH == 32
+    return __builtin_bswap32(x);
+#elif MP_HAS_BUILTIN(__builtin_bswap64) && MP_UINT_WIDTH == 64
+    return __builtin_bswap64(x);
+#else
+#error "Not implemented"
+#endif
+}
+
 static inline mp_bool mp_uint_has_single_bit(mp_uint a)
 {
     return mp_uint_popcount(a) == 1;
@@ -158,13 +172,13 @@ static inline mp_uint mp_uint_inv(mp_uint d)
         mp_uint v1 = (v0 << 11) - ((v0 * v0 * d40) >> 40) - 1;
         mp_uint v2 =
             (v1 << 13) + ((v1 * (((mp_uint)1 << 60) - v1 * d40)) >> 47);
-        mp_uint v3 =
-            (v2 >> 31) +
-            ((v2 * (((d0mask & v0) >> 1) - mp_uint_mulhi(v2, d63))) >> 1);
+        mp_uint e = ((v2 >> 1) & d0mask) - v2 * d63;
+        mp_uint v3 = (v2 << 31) + (mp_uint_mulhi(v2, e) >> 1);
         mp_uint v4lo, v4hi;
 
-        v4lo = mp_uint_mul(v3, d, &v4hi) + 1;
-        v4hi += (v4lo < 1) + 1;
+        // v4 = v3 - floor((B + v3 + 1) d / B)
+        v4lo = mp_uint_mul(v3, d, &v4hi) + d;
+        v4hi += (v4lo < d) + d;
 
         mp_uint v4 = v3 - v4hi;
         return v4;
@@ -176,6 +190,33 @@ static inline mp_uint mp_uint_inv(mp_uint d)
     }
 }
 
+static inline mp_uint mp_uint_div_inv(
+    mp_uint n1, mp_uint n0, mp_uint d, mp_uint v, mp_uint *r)
+{
+    MP_EXPECTS(d > n1);
+    MP_EXPECTS(d >> (MP_UINT_WIDTH - 1));
+    MP_EXPECTS(mp_uint_inv(d) == v);
+
+    mp_uint q0, q1, r0;
+
+    q0 = mp_uint_mul(n1, v, &q1) + n0;
+    q1 += n1 + (q0 < n0) + 1;
+    r0 = n0 - q1 * d;
+
+    if (r0 > q0) {
+        --q1;
+        r0 += d;
+    }
+
+    if (r0 >= d) {
+        q1 += 1;
+        r0 -= d;
+    }
+
+    *r = r0;
+    return q1;
+}
+
 static inline mp_uint mp_uint_div(mp_uint n1, mp_uint n0, mp_uint d, mp_uint *r)
 {
     MP_EXPECTS(d > n1);
@@ -188,34 +229,101 @@ static inline mp_uint mp_uint_div(mp_uint n1, mp_uint n0, mp_uint d, mp_uint *r)
 #elif MP_ARCH_X86 && MP_INLINE_ASM
     asm("divl %[d]" : "=a"(q), "=d"(*r) : "d"(n1), "a"(n0), [d] "rm"(d) : "cc");
 #else
-    return mp_uint_div(n1, n0, d, mp_uint_inv(d), r);
+    q = mp_uint_div_inv(n1, n0, d, mp_uint_inv(d), r);
 #endif
+
+    return q;
 }
 
-static inline mp_uint mp_uint_div_inv(
-    mp_uint n1, mp_uint n0, mp_uint d, mp_uint v, mp_uint *r)
+// Inverse of an odd d modulo B, by Newton iteration v = v (2 - d v) starting
+// from a value that is correct to 5 bits
+
+static inline mp_uint mp_uint_binvert(mp_uint d)
 {
-    MP_EXPECTS(d > n1);
-    MP_EXPECTS(d >> (MP_UINT_WIDTH - 1));
-    MP_EXPECTS(mp_uint_inv(d) == v);
+    MP_EXPECTS(d & 1);
 
-    mp_uint q0, q1, r0;
+    mp_uint v = (3 * d) ^ 2;
 
-    q0 = mp_uint_mul(n1, v, &q1) + n0;
-    q1 += n1 + (q0 < n0) + 1;
-    r0 = n0 - q1 * d;
+    for (mp_size bits = 5; bits < MP_UINT_WIDTH; bits *= 2) {
+        v *= 2 - d * v;
+    }
 
-    if (r0 > q0) {
+    return v;
+}
+
+// Inverse of the two limb divisor (d1, d0), floor((B^3 - 1) / d) - B
+
+static inline mp_uint mp_uint_inv_3by2(mp_uint d1, mp_uint d0)
+{
+    MP_EXPECTS(d1 >> (MP_UINT_WIDTH - 1));
+
+    mp_uint v = mp_uint_inv(d1);
+    mp_uint p = d1 * v + d0;
+
+    if (p < d0) {
+        --v;
+
+        if (p >= d1) {
+            --v;
+            p -= d1;
+        }
+
+        p -= d1;
+    }
+
+    mp_uint t1, t0 = mp_uint_mul(d0, v, &t1);
+
+    p += t1;
+
+    if (p < t1) {
+        --v;
+
+        if (p > d1 || (p == d1 && t0 >= d0)) {
+            --v;
+        }
+    }
+
+    return v;
+}
+
+// q = floor((n2, n1, n0) / (d1, d0)), for (n2, n1) < (d1, d0)
+
+static inline mp_uint mp_uint_div_3by2(mp_uint n2, mp_uint n1, mp_uint n0,
+                                       mp_uint d1, mp_uint d0, mp_uint v,
+                                       mp_uint *r1, mp_uint *r0)
+{
+    MP_EXPECTS(n2 < d1 || (n2 == d1 && n1 < d0));
+
+    mp_uint q1, q0 = mp_uint_mul(n2, v, &q1);
+    mp_uint t1, t0;
+    mp_uint s1, s0;
+
+    q0 += n1;
+    q1 += n2 + (q0 < n1);
+
+    // (s1, s0) = (n1 - q1 d1, n0) - q1 d0 - d
+    s1 = n1 - q1 * d1;
+    t0 = mp_uint_mul(d0, q1, &t1);
+    s1 -= t1 + (n0 < t0);
+    s0 = n0 - t0;
+    s1 -= d1 + (s0 < d0);
+    s0 -= d0;
+    ++q1;
+
+    if (s1 >= q0) {
         --q1;
-        r += d;
+        s0 += d0;
+        s1 += d1 + (s0 < d0);
     }
 
-    if (r0 >= d) {
-        q1 += 1;
-        r -= d;
+    if (s1 > d1 || (s1 == d1 && s0 >= d0)) {
+        ++q1;
+        s1 -= d1 + (s0 < d0);
+        s0 -= d0;
     }
 
-    *r = r0;
+    *r1 = s1;
+    *r0 = s0;
     return q1;
 }
 
@@ -233,8 +341,139 @@ static inline mp_uint mp_uint_div_inv(
     }
 
 MP_DEFINE_ALLOC_FUNCS(uint, mp_uint)
+MP_DEFINE_ALLOC_FUNCS(char, char)
 MP_DEFINE_ALLOC_FUNCS(bigint, struct mp_bigint)
 
+mp_uint mp_mul_with_alloc(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                          mp_size bn, mp_uint *rp, struct mp_allocator *alloc);
+
+mp_uint mp_sqr_with_alloc(const mp_uint *ap, mp_size an, mp_uint *rp,
+                          struct mp_allocator *alloc);
+
+enum mp_errc mp_div_with_alloc(const mp_uint *np, mp_size nn,
+                               const mp_uint *dp, mp_size dn, mp_uint *qp,
+                               mp_uint *rp, struct mp_allocator *alloc);
+
+enum mp_errc mp_divexact_with_alloc(const mp_uint *np, mp_size nn,
+                                    const mp_uint *dp, mp_size dn, mp_uint *qp,
+                                    struct mp_allocator *alloc);
+
+// Kernels bound at load time to the best implementation for the CPU, see
+// cpu.c. Every kernel has a portable version with the suffix _generic.
+
+typedef mp_uint mp_add_n_kernel(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp);
+typedef mp_uint mp_mul_uint_kernel(
+    const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp);
+typedef void mp_mul_basecase_kernel(
+    const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn, mp_uint *rp);
+typedef void mp_bit_n_kernel(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp);
+typedef void mp_bit_not_kernel(const mp_uint *ap, mp_size an, mp_uint *rp);
+typedef mp_uint mp_shift_kernel(
+    const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp);
+typedef mp_size mp_popcount_kernel(const mp_uint *ap, mp_size an);
+typedef mp_size mp_hamming_n_kernel(
+    const mp_uint *ap, const mp_uint *bp, mp_size n);
+typedef mp_size mp_scan_kernel(const char *s, mp_size n);
+typedef void mp_store_be_kernel(const mp_uint *ap, mp_size n, mp_byte *bytes);
+typedef void mp_load_be_kernel(const mp_byte *bytes, mp_size n, mp_uint *rp);
+
+struct mp_kernels {
+    mp_add_n_kernel *_Atomic add_n;
+    mp_add_n_kernel *_Atomic sub_n;
+    mp_mul_uint_kernel *_Atomic mul_uint;
+    mp_mul_uint_kernel *_Atomic addmul_uint;
+    mp_mul_uint_kernel *_Atomic submul_uint;
+    mp_mul_basecase_kernel *_Atomic mul_basecase;
+    mp_bit_n_kernel *_Atomic bit_and_n;
+    mp_bit_n_kernel *_Atomic bit_or_n;
+    mp_bit_n_kernel *_Atomic bit_xor_n;
+    mp_bit_not_kernel *_Atomic bit_not;
+    mp_shift_kernel *_Atomic left_shift;
+    mp_shift_kernel *_Atomic right_shift;
+    mp_popcount_kernel *_Atomic popcount;
+    mp_hamming_n_kernel *_Atomic hamming_n;
+    mp_scan_kernel *_Atomic scan_10;
+    mp_scan_kernel *_Atomic scan_16;
+    mp_store_be_kernel *_Atomic store_be;
+    mp_load_be_kernel *_Atomic load_be;
+};
+
+extern struct mp_kernels mp_kernels;
+
+#define MP_KERNEL(name)                                                        \
+    atomic_load_explicit(&mp_kernels.name, memory_order_relaxed)
+
+mp_add_n_kernel mp_add_n_generic;
+mp_add_n_kernel mp_sub_n_generic;
+mp_mul_uint_kernel mp_mul_uint_generic;
+mp_mul_uint_kernel mp_addmul_uint_generic;
+mp_mul_uint_kernel mp_submul_uint_generic;
+mp_mul_basecase_kernel mp_mul_basecase_generic;
+mp_bit_n_kernel mp_bit_and_n_generic;
+mp_bit_n_kernel mp_bit_or_n_generic;
+mp_bit_n_kernel mp_bit_xor_n_generic;
+mp_bit_not_kernel mp_bit_not_generic;
+mp_shift_kernel mp_left_shift_generic;
+mp_shift_kernel mp_right_shift_generic;
+mp_popcount_kernel mp_popcount_generic;
+mp_hamming_n_kernel mp_hamming_n_generic;
+mp_scan_kernel mp_scan_10_generic;
+mp_scan_kernel mp_scan_16_generic;
+mp_store_be_kernel mp_store_be_generic;
+mp_load_be_kernel mp_load_be_generic;
+
+#if MP_ASM_X86_64
+mp_add_n_kernel mp_add_n_x86_64;
+mp_add_n_kernel mp_sub_n_x86_64;
+
+// These need BMI2 and ADX
+mp_mul_uint_kernel mp_mul_uint_adx;
+mp_mul_uint_kernel mp_addmul_uint_adx;
+mp_mul_uint_kernel mp_submul_uint_adx;
+mp_mul_basecase_kernel mp_mul_basecase_adx;
+#endif
+
+#if MP_SIMD_X86_64
+mp_bit_n_kernel mp_bit_and_n_avx2;
+mp_bit_n_kernel mp_bit_or_n_avx2;
+mp_bit_n_kernel mp_bit_xor_n_avx2;
+mp_bit_not_kernel mp_bit_not_avx2;
+mp_shift_kernel mp_left_shift_avx2;
+mp_shift_kernel mp_right_shift_avx2;
+mp_popcount_kernel mp_popcount_avx2;
+mp_hamming_n_kernel mp_hamming_n_avx2;
+mp_scan_kernel mp_scan_10_avx2;
+mp_scan_kernel mp_scan_16_avx2;
+mp_store_be_kernel mp_store_be_avx2;
+mp_load_be_kernel mp_load_be_avx2;
+
+mp_bit_n_kernel mp_bit_and_n_avx512;
+mp_bit_n_kernel mp_bit_or_n_avx512;
+mp_bit_n_kernel mp_bit_xor_n_avx512;
+mp_bit_not_kernel mp_bit_not_avx512;
+mp_popcount_kernel mp_popcount_avx512;
+mp_hamming_n_kernel mp_hamming_n_avx512;
+#endif
+
+enum mp_errc mp_mul_fft(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                        mp_size bn, mp_uint *rp, struct mp_allocator *alloc);
+
+enum mp_errc mp_mul_ntt(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                        mp_size bn, mp_uint *rp, struct mp_allocator *alloc);
+
+enum mp_errc mp_mulmid_ntt(const mp_uint *ap, mp_size an, const mp_uint *bp,
+                           mp_size bn, mp_uint *rp, struct mp_allocator *alloc);
+
+mp_size mp_ntt_prepared_size(mp_size bn);
+
+void mp_ntt_prepare(const mp_uint *bp, mp_size bn, mp_uint *data);
+
+enum mp_errc mp_mul_ntt_prepared(const mp_uint *ap, mp_size an, mp_size bn,
+                                 const mp_uint *data, mp_uint *rp,
+                                 struct mp_allocator *alloc);
+
 #define mp_same_sign(a, b) ((mp_int)((a) ^ (b)) >= 0)
 
 static inline mp_int mp_int_abs(mp_int value)
@@ -255,4 +494,34 @@ static inline struct mp_to_string_result mp_to_string_ok(char *ptr)
     return (struct mp_to_string_result){ .ptr = ptr, .ec = MP_ERRC_OK };
 }
 
+static inline struct mp_from_string_result mp_from_string_error(
+    enum mp_errc ec, const char *ptr, mp_size size)
+{
+    return (struct mp_from_string_result){
+        .ec = ec,
+        .ptr = ptr,
+        .size = size
+    };
+}
+
+static inline struct mp_from_string_result mp_from_string_ok(
+    const char *ptr, mp_size size)
+{
+    return mp_from_string_error(MP_ERRC_OK, ptr, size);
+}
+
+// 0 to 35 for a digit of any base up to 36, or 36
+
+static inline unsigned mp_digit_value(char c)
+{
+    unsigned d = (unsigned char)c - '0';
+
+    if (d < 10) {
+        return d;
+    }
+
+    d = ((unsigned char)c | 0x20) - 'a';
+    return d < 26 ? d + 10 : 36;
+}
+
 #endif
@@ -0,0 +1,305 @@
+#include <mp/config.h>
+#include <mp/mp.h>
+#include "./util.h"
+
+// Kernels for x86-64. The loops take four limbs per iteration, after the
+// n % 4 low limbs have been done in C. The loop counter is kept with lea and
+// dec, which leave the carry flag alone, so one carry chain runs through the
+// whole operand.
+
+#if MP_ASM_X86_64
+
+mp_uint mp_add_n_x86_64(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    MP_EXPECTS(n);
+
+    mp_size m = n / 4;
+    mp_uint c = 0;
+
+    for (n %= 4; n; n--) {
+        mp_uint a = *ap++;
+        mp_uint b = *bp++ + c;
+        mp_uint r = a + b;
+
+        c = (b < c) + (r < b);
+        *rp++ = r;
+    }
+
+    if (!m) {
+        return c;
+    }
+
+    mp_uint t0, t1, t2, t3;
+
+    asm("neg %[c]\n\t"
+        "1:\n\t"
+        "mov (%[a]), %[t0]\n\t"
+        "mov 8(%[a]), %[t1]\n\t"
+        "mov 16(%[a]), %[t2]\n\t"
+        "mov 24(%[a]), %[t3]\n\t"
+        "adc (%[b]), %[t0]\n\t"
+        "adc 8(%[b]), %[t1]\n\t"
+        "adc 16(%[b]), %[t2]\n\t"
+        "adc 24(%[b]), %[t3]\n\t"
+        "mov %[t0], (%[r])\n\t"
+        "mov %[t1], 8(%[r])\n\t"
+        "mov %[t2], 16(%[r])\n\t"
+        "mov %[t3], 24(%[r])\n\t"
+        "lea 32(%[a]), %[a]\n\t"
+        "lea 32(%[b]), %[b]\n\t"
+        "lea 32(%[r]), %[r]\n\t"
+        "dec %[m]\n\t"
+        "jnz 1b\n\t"
+        "sbb %[c], %[c]\n\t"
+        "neg %[c]"
+        : [a] "+r"(ap), [b] "+r"(bp), [r] "+r"(rp), [m] "+r"(m), [c] "+r"(c),
+          [t0] "=&r"(t0), [t1] "=&r"(t1), [t2] "=&r"(t2), [t3] "=&r"(t3)
+        :
+        : "cc", "memory");
+
+    return c;
+}
+
+mp_uint mp_sub_n_x86_64(
+    const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)
+{
+    MP_EXPECTS(n);
+
+    mp_size m = n / 4;
+    mp_uint c = 0;
+
+    for (n %= 4; n; n--) {
+        mp_uint a = *ap++;
+        mp_uint b = *bp++ + c;
+        mp_uint r = a - b;
+
+        c = (b < c) + (a < b);
+        *rp++ = r;
+    }
+
+    if (!m) {
+        return c;
+    }
+
+    mp_uint t0, t1, t2, t3;
+
+    asm("neg %[c]\n\t"
+        "1:\n\t"
+        "mov (%[a]), %[t0]\n\t"
+        "mov 8(%[a]), %[t1]\n\t"
+        "mov 16(%[a]), %[t2]\n\t"
+        "mov 24(%[a]), %[t3]\n\t"
+        "sbb (%[b]), %[t0]\n\t"
+        "sbb 8(%[b]), %[t1]\n\t"
+        "sbb 16(%[b]), %[t2]\n\t"
+        "sbb 24(%[b]), %[t3]\n\t"
+        "mov %[t0], (%[r])\n\t"
+        "mov %[t1], 8(%[r])\n\t"
+        "mov %[t2], 16(%[r])\n\t"
+        "mov %[t3], 24(%[r])\n\t"
+        "lea 32(%[a]), %[a]\n\t"
+        "lea 32(%[b]), %[b]\n\t"
+        "lea 32(%[r]), %[r]\n\t"
+        "dec %[m]\n\t"
+        "jnz 1b\n\t"
+        "sbb %[c], %[c]\n\t"
+        "neg %[c]"
+        : [a] "+r"(ap), [b] "+r"(bp), [r] "+r"(rp), [m] "+r"(m), [c] "+r"(c),
+          [t0] "=&r"(t0), [t1] "=&r"(t1), [t2] "=&r"(t2), [t3] "=&r"(t3)
+        :
+        : "cc", "memory");
+
+    return c;
+}
+
+// mulx leaves the flags alone, so the high half of each product can be added
+// into the next low half with one adc chain. addmul keeps a second chain for
+// adding in r on the overflow flag with adox. Both chains are folded into the
+// carry limb at the end of each iteration, as dec clobbers the overflow flag.
+
+mp_uint mp_mul_uint_adx(const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+
+    mp_size m = an / 4;
+    mp_uint c = 0;
+
+    for (an %= 4; an; an--) {
+        mp_uint hi, lo = mp_uint_mul(*ap++, b, &hi);
+
+        lo += c;
+        c = hi + (lo < c);
+        *rp++ = lo;
+    }
+
+    if (!m) {
+        return c;
+    }
+
+    mp_uint t0, t1;
+
+    asm("1:\n\t"
+        "mulx (%[a]), %[t0], %[t1]\n\t"
+        "add %[c], %[t0]\n\t"
+        "mov %[t0], (%[r])\n\t"
+        "mulx 8(%[a]), %[t0], %[c]\n\t"
+        "adc %[t1], %[t0]\n\t"
+        "mov %[t0], 8(%[r])\n\t"
+        "mulx 16(%[a]), %[t0], %[t1]\n\t"
+        "adc %[c], %[t0]\n\t"
+        "mov %[t0], 16(%[r])\n\t"
+        "mulx 24(%[a]), %[t0], %[c]\n\t"
+        "adc %[t1], %[t0]\n\t"
+        "mov %[t0], 24(%[r])\n\t"
+        "adc $0, %[c]\n\t"
+        "lea 32(%[a]), %[a]\n\t"
+        "lea 32(%[r]), %[r]\n\t"
+        "dec %[m]\n\t"
+        "jnz 1b"
+        : [a] "+r"(ap), [r] "+r"(rp), [m] "+r"(m), [c] "+r"(c),
+          [t0] "=&r"(t0), [t1] "=&r"(t1)
+        : "d"(b)
+        : "cc", "memory");
+
+    return c;
+}
+
+mp_uint mp_addmul_uint_adx(
+    const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+
+    mp_size m = an / 4;
+    mp_uint c = 0;
+
+    for (an %= 4; an; an--) {
+        mp_uint r = *rp;
+        mp_uint hi, lo = mp_uint_mul(*ap++, b, &hi);
+
+        lo += c;
+        r += lo;
+        c = hi + (lo < c) + (r < lo);
+        *rp++ = r;
+    }
+
+    if (!m) {
+        return c;
+    }
+
+    mp_uint t0, t1, z;
+
+    asm("1:\n\t"
+        "xor %k[z], %k[z]\n\t"
+        "mulx (%[a]), %[t0], %[t1]\n\t"
+        "adcx %[c], %[t0]\n\t"
+        "adox (%[r]), %[t0]\n\t"
+        "mov %[t0], (%[r])\n\t"
+        "mulx 8(%[a]), %[t0], %[c]\n\t"
+        "adcx %[t1], %[t0]\n\t"
+        "adox 8(%[r]), %[t0]\n\t"
+        "mov %[t0], 8(%[r])\n\t"
+        "mulx 16(%[a]), %[t0], %[t1]\n\t"
+        "adcx %[c], %[t0]\n\t"
+        "adox 16(%[r]), %[t0]\n\t"
+        "mov %[t0], 16(%[r])\n\t"
+        "mulx 24(%[a]), %[t0], %[c]\n\t"
+        "adcx %[t1], %[t0]\n\t"
+        "adox 24(%[r]), %[t0]\n\t"
+        "mov %[t0], 24(%[r])\n\t"
+        "adcx %[z], %[c]\n\t"
+        "adox %[z], %[c]\n\t"
+        "lea 32(%[a]), %[a]\n\t"
+        "lea 32(%[r]), %[r]\n\t"
+        "dec %[m]\n\t"
+        "jnz 1b"
+        : [a] "+r"(ap), [r] "+r"(rp), [m] "+r"(m), [c] "+r"(c),
+          [t0] "=&r"(t0), [t1] "=&r"(t1), [z] "=&r"(z)
+        : "d"(b)
+        : "cc", "memory");
+
+    return c;
+}
+
+// r - x is taken as r + ~x + 1 with adcx, as sbb would clobber the overflow
+// flag that the product chain runs on. The carry flag starts out set, and is
+// folded back in as a borrow of 1 - carry.
+
+mp_uint mp_submul_uint_adx(
+    const mp_uint *ap, mp_size an, mp_uint b, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+
+    mp_size m = an / 4;
+    mp_uint c = 0;
+
+    for (an %= 4; an; an--) {
+        mp_uint r = *rp;
+        mp_uint hi, lo = mp_uint_mul(*ap++, b, &hi);
+
+        lo += c;
+        c = hi + (lo < c) + (r < lo);
+        *rp++ = r - lo;
+    }
+
+    if (!m) {
+        return c;
+    }
+
+    mp_uint t0, t1, z;
+
+    asm("1:\n\t"
+        "xor %k[z], %k[z]\n\t"
+        "stc\n\t"
+        "mulx (%[a]), %[t0], %[t1]\n\t"
+        "adox %[c], %[t0]\n\t"
+        "not %[t0]\n\t"
+        "adcx (%[r]), %[t0]\n\t"
+        "mov %[t0], (%[r])\n\t"
+        "mulx 8(%[a]), %[t0], %[c]\n\t"
+        "adox %[t1], %[t0]\n\t"
+        "not %[t0]\n\t"
+        "adcx 8(%[r]), %[t0]\n\t"
+        "mov %[t0], 8(%[r])\n\t"
+        "mulx 16(%[a]), %[t0], %[t1]\n\t"
+        "adox %[c], %[t0]\n\t"
+        "not %[t0]\n\t"
+        "adcx 16(%[r]), %[t0]\n\t"
+        "mov %[t0], 16(%[r])\n\t"
+        "mulx 24(%[a]), %[t0], %[c]\n\t"
+        "adox %[t1], %[t0]\n\t"
+        "not %[t0]\n\t"
+        "adcx 24(%[r]), %[t0]\n\t"
+        "mov %[t0], 24(%[r])\n\t"
+        "adox %[z], %[c]\n\t"
+        "sbb $-1, %[c]\n\t"
+        "lea 32(%[a]), %[a]\n\t"
+        "lea 32(%[r]), %[r]\n\t"
+        "dec %[m]\n\t"
+        "jnz 1b"
+        : [a] "+r"(ap), [r] "+r"(rp), [m] "+r"(m), [c] "+r"(c),
+          [t0] "=&r"(t0), [t1] "=&r"(t1), [z] "=&r"(z)
+        : "d"(b)
+        : "cc", "memory");
+
+    return c;
+}
+
+// The single row kernel runs at about one product per cycle, which beats
+// taking two rows at a time, as that has to fold its carries every limb.
+
+void mp_mul_basecase_adx(
+    const mp_uint *ap, mp_size an, const mp_uint *bp, mp_size bn, mp_uint *rp)
+{
+    MP_EXPECTS(an >= bn);
+    MP_EXPECTS(bn);
+
+    rp[an] = mp_mul_uint_adx(ap, an, *bp, rp);
+
+    while (--bn) {
+        ++rp;
+        rp[an] = mp_addmul_uint_adx(ap, an, *++bp, rp);
+    }
+}
+
+#endif
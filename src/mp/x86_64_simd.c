@@ -0,0 +1,499 @@
+#include <mp/config.h>
+#include <mp/mp.h>
+#include "./util.h"
+
+// AVX2 and AVX-512 kernels for the bitwise operations, shifts, popcount, the
+// digit scans of string input and big endian bytes. They are compiled with
+// per function target attributes, so that the rest of the library does not
+// need -mavx2, and are only bound when cpu.c finds the features.
+//
+// Popcount uses the Harley-Seal carry save adder tree over blocks of 16
+// vectors, which leaves a full vector popcount for every 16 vectors instead
+// of every one. Vector popcounts look up each nibble with a byte shuffle and
+// sum the bytes with psadbw.
+
+#if MP_SIMD_X86_64
+
+#include <immintrin.h>
+
+#define MP_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define MP_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,popcnt")))
+
+#define MP_DEFINE_BIT_N_AVX2(name, op)                                         \
+    MP_TARGET_AVX2 void mp_bit_##name##_n_avx2(                                \
+        const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)          \
+    {                                                                          \
+        MP_EXPECTS(n);                                                         \
+                                                                               \
+        mp_size i = 0;                                                         \
+                                                                               \
+        for (; i + 8 <= n; i += 8) {                                           \
+            __m256i a0 = _mm256_loadu_si256((const void *)(ap + i));           \
+            __m256i a1 = _mm256_loadu_si256((const void *)(ap + i + 4));       \
+            __m256i b0 = _mm256_loadu_si256((const void *)(bp + i));           \
+            __m256i b1 = _mm256_loadu_si256((const void *)(bp + i + 4));       \
+                                                                               \
+            _mm256_storeu_si256((void *)(rp + i), a0 op b0);                   \
+            _mm256_storeu_si256((void *)(rp + i + 4), a1 op b1);               \
+        }                                                                      \
+                                                                               \
+        for (; i < n; i++) {                                                   \
+            rp[i] = ap[i] op bp[i];                                            \
+        }                                                                      \
+    }
+
+MP_DEFINE_BIT_N_AVX2(and, &)
+MP_DEFINE_BIT_N_AVX2(or, |)
+MP_DEFINE_BIT_N_AVX2(xor, ^)
+
+MP_TARGET_AVX2 void mp_bit_not_avx2(const mp_uint *ap, mp_size an, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+
+    __m256i ones = _mm256_set1_epi64x(-1);
+    mp_size i = 0;
+
+    for (; i + 8 <= an; i += 8) {
+        __m256i a0 = _mm256_loadu_si256((const void *)(ap + i));
+        __m256i a1 = _mm256_loadu_si256((const void *)(ap + i + 4));
+
+        _mm256_storeu_si256((void *)(rp + i), a0 ^ ones);
+        _mm256_storeu_si256((void *)(rp + i + 4), a1 ^ ones);
+    }
+
+    for (; i < an; i++) {
+        rp[i] = ~ap[i];
+    }
+}
+
+// Per 64-bit lane popcounts of v
+
+MP_TARGET_AVX2 static inline __m256i mp_popcount_256(__m256i v)
+{
+    __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2,
+                                      3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2,
+                                      2, 3, 2, 3, 3, 4);
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_shuffle_epi8(lookup, v & nibble);
+    __m256i hi = _mm256_shuffle_epi8(
+        lookup, _mm256_srli_epi16(v, 4) & nibble);
+
+    return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+// h:l = a + b + c, bitwise
+
+#define MP_CSA_256(h, l, a, b, c)                                              \
+    do {                                                                       \
+        __m256i u = (a) ^ (b);                                                 \
+        __m256i v = (c);                                                       \
+                                                                               \
+        (h) = ((a) & (b)) | (u & v);                                           \
+        (l) = u ^ v;                                                           \
+    } while (0)
+
+// Loads limbs i to i + 3 of a, or of a ^ b when b is given
+
+MP_TARGET_AVX2 static inline __m256i mp_load_256(
+    const mp_uint *ap, const mp_uint *bp, mp_size i)
+{
+    __m256i v = _mm256_loadu_si256((const void *)(ap + i));
+
+    if (bp) {
+        v ^= _mm256_loadu_si256((const void *)(bp + i));
+    }
+
+    return v;
+}
+
+MP_TARGET_AVX2 static inline mp_size mp_hamming_avx2_impl(
+    const mp_uint *ap, const mp_uint *bp, mp_size n)
+{
+    __m256i total = _mm256_setzero_si256();
+    __m256i ones = _mm256_setzero_si256();
+    __m256i twos = _mm256_setzero_si256();
+    __m256i fours = _mm256_setzero_si256();
+    __m256i eights = _mm256_setzero_si256();
+    __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+    mp_size i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        MP_CSA_256(twos_a, ones, ones, mp_load_256(ap, bp, i),
+                   mp_load_256(ap, bp, i + 4));
+        MP_CSA_256(twos_b, ones, ones, mp_load_256(ap, bp, i + 8),
+                   mp_load_256(ap, bp, i + 12));
+        MP_CSA_256(fours_a, twos, twos, twos_a, twos_b);
+        MP_CSA_256(twos_a, ones, ones, mp_load_256(ap, bp, i + 16),
+                   mp_load_256(ap, bp, i + 20));
+        MP_CSA_256(twos_b, ones, ones, mp_load_256(ap, bp, i + 24),
+                   mp_load_256(ap, bp, i + 28));
+        MP_CSA_256(fours_b, twos, twos, twos_a, twos_b);
+        MP_CSA_256(eights_a, fours, fours, fours_a, fours_b);
+        MP_CSA_256(twos_a, ones, ones, mp_load_256(ap, bp, i + 32),
+                   mp_load_256(ap, bp, i + 36));
+        MP_CSA_256(twos_b, ones, ones, mp_load_256(ap, bp, i + 40),
+                   mp_load_256(ap, bp, i + 44));
+        MP_CSA_256(fours_a, twos, twos, twos_a, twos_b);
+        MP_CSA_256(twos_a, ones, ones, mp_load_256(ap, bp, i + 48),
+                   mp_load_256(ap, bp, i + 52));
+        MP_CSA_256(twos_b, ones, ones, mp_load_256(ap, bp, i + 56),
+                   mp_load_256(ap, bp, i + 60));
+        MP_CSA_256(fours_b, twos, twos, twos_a, twos_b);
+        MP_CSA_256(eights_b, fours, fours, fours_a, fours_b);
+        MP_CSA_256(sixteens, eights, eights, eights_a, eights_b);
+
+        total = _mm256_add_epi64(total, mp_popcount_256(sixteens));
+    }
+
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(
+        total, _mm256_slli_epi64(mp_popcount_256(eights), 3));
+    total = _mm256_add_epi64(
+        total, _mm256_slli_epi64(mp_popcount_256(fours), 2));
+    total = _mm256_add_epi64(
+        total, _mm256_slli_epi64(mp_popcount_256(twos), 1));
+    total = _mm256_add_epi64(total, mp_popcount_256(ones));
+
+    for (; i + 4 <= n; i += 4) {
+        total = _mm256_add_epi64(
+            total, mp_popcount_256(mp_load_256(ap, bp, i)));
+    }
+
+    mp_size count = _mm256_extract_epi64(total, 0) +
+                    _mm256_extract_epi64(total, 1) +
+                    _mm256_extract_epi64(total, 2) +
+                    _mm256_extract_epi64(total, 3);
+
+    for (; i < n; i++) {
+        count += mp_uint_popcount(bp ? ap[i] ^ bp[i] : ap[i]);
+    }
+
+    return count;
+}
+
+MP_TARGET_AVX2 mp_size mp_popcount_avx2(const mp_uint *ap, mp_size an)
+{
+    MP_EXPECTS(an);
+
+    return mp_hamming_avx2_impl(ap, NULL, an);
+}
+
+MP_TARGET_AVX2 mp_size mp_hamming_n_avx2(
+    const mp_uint *ap, const mp_uint *bp, mp_size n)
+{
+    MP_EXPECTS(n);
+
+    return mp_hamming_avx2_impl(ap, bp, n);
+}
+
+// Each result limb takes its bits from the limb at the same index and its
+// neighbour, which an unaligned load one limb over gives for the whole vector.
+// The left shift goes down and the right shift up, as the generic versions,
+// so that rp may be ap. The limbs that do not fill a vector are left to the
+// generic versions, whose return values are then already in rp.
+
+MP_TARGET_AVX2 mp_uint mp_left_shift_avx2(
+    const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+    MP_EXPECTS(bits < MP_UINT_WIDTH);
+    MP_EXPECTS(bits);
+
+    __m128i l = _mm_cvtsi64_si128((long long)bits);
+    __m128i r = _mm_cvtsi64_si128((long long)(MP_UINT_WIDTH - bits));
+    mp_uint ret = ap[an - 1] >> (MP_UINT_WIDTH - bits);
+
+    for (; an >= 5; an -= 4) {
+        __m256i a = _mm256_loadu_si256((const void *)(ap + an - 4));
+        __m256i b = _mm256_loadu_si256((const void *)(ap + an - 5));
+
+        a = _mm256_sll_epi64(a, l) | _mm256_srl_epi64(b, r);
+        _mm256_storeu_si256((void *)(rp + an - 4), a);
+    }
+
+    mp_left_shift_generic(ap, an, bits, rp);
+    return ret;
+}
+
+MP_TARGET_AVX2 mp_uint mp_right_shift_avx2(
+    const mp_uint *ap, mp_size an, mp_size bits, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+    MP_EXPECTS(bits < MP_UINT_WIDTH);
+    MP_EXPECTS(bits);
+
+    __m128i r = _mm_cvtsi64_si128((long long)bits);
+    __m128i l = _mm_cvtsi64_si128((long long)(MP_UINT_WIDTH - bits));
+    mp_uint ret = *ap << (MP_UINT_WIDTH - bits);
+    mp_size i = 0;
+
+    for (; i + 5 <= an; i += 4) {
+        __m256i a = _mm256_loadu_si256((const void *)(ap + i));
+        __m256i b = _mm256_loadu_si256((const void *)(ap + i + 1));
+
+        a = _mm256_srl_epi64(a, r) | _mm256_sll_epi64(b, l);
+        _mm256_storeu_si256((void *)(rp + i), a);
+    }
+
+    mp_right_shift_generic(ap + i, an - i, bits, rp + i);
+    return ret;
+}
+
+// A byte c is a decimal digit exactly when c - '0', as an unsigned byte, is
+// at most 9, which min finds without a signed compare
+
+MP_TARGET_AVX2 static inline mp_size mp_scan_avx2(
+    const char *s, mp_size n, mp_bool hex)
+{
+    __m256i zero = _mm256_set1_epi8('0');
+    __m256i nine = _mm256_set1_epi8(9);
+    __m256i a = _mm256_set1_epi8('a');
+    __m256i five = _mm256_set1_epi8(5);
+    __m256i lower = _mm256_set1_epi8(0x20);
+    mp_size i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i c = _mm256_loadu_si256((const void *)(s + i));
+        __m256i d = _mm256_sub_epi8(c, zero);
+        __m256i ok = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+
+        if (hex) {
+            __m256i l = _mm256_sub_epi8(c | lower, a);
+
+            ok |= _mm256_cmpeq_epi8(_mm256_min_epu8(l, five), l);
+        }
+
+        unsigned mask = _mm256_movemask_epi8(ok);
+
+        if (~mask) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+
+    s += i;
+    n -= i;
+    return i + (hex ? mp_scan_16_generic(s, n) : mp_scan_10_generic(s, n));
+}
+
+MP_TARGET_AVX2 mp_size mp_scan_10_avx2(const char *s, mp_size n)
+{
+    return mp_scan_avx2(s, n, mp_false);
+}
+
+MP_TARGET_AVX2 mp_size mp_scan_16_avx2(const char *s, mp_size n)
+{
+    return mp_scan_avx2(s, n, mp_true);
+}
+
+// Reverses the 32 bytes of v: pshufb reverses each 128-bit lane and vpermq
+// swaps the lanes
+
+MP_TARGET_AVX2 static inline __m256i mp_reverse_256(__m256i v)
+{
+    __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5,
+                                       4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10,
+                                       9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+    return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, reverse), 0x4e);
+}
+
+MP_TARGET_AVX2 void mp_store_be_avx2(
+    const mp_uint *ap, mp_size n, mp_byte *bytes)
+{
+    mp_size i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((const void *)(ap + n - 4 - i));
+
+        _mm256_storeu_si256((void *)(bytes + i * 8), mp_reverse_256(a));
+    }
+
+    mp_store_be_generic(ap, n - i, bytes + i * 8);
+}
+
+MP_TARGET_AVX2 void mp_load_be_avx2(
+    const mp_byte *bytes, mp_size n, mp_uint *rp)
+{
+    mp_size i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((const void *)(bytes + i * 8));
+
+        _mm256_storeu_si256((void *)(rp + n - 4 - i), mp_reverse_256(a));
+    }
+
+    mp_load_be_generic(bytes + i * 8, n - i, rp);
+}
+
+// The AVX-512 kernels do their last partial vector with masked loads and
+// stores, which do not touch the masked out limbs.
+
+#define MP_DEFINE_BIT_N_AVX512(name, op)                                       \
+    MP_TARGET_AVX512 void mp_bit_##name##_n_avx512(                            \
+        const mp_uint *ap, const mp_uint *bp, mp_size n, mp_uint *rp)          \
+    {                                                                          \
+        MP_EXPECTS(n);                                                         \
+                                                                               \
+        mp_size i = 0;                                                         \
+                                                                               \
+        for (; i + 16 <= n; i += 16) {                                         \
+            __m512i a0 = _mm512_loadu_si512(ap + i);                           \
+            __m512i a1 = _mm512_loadu_si512(ap + i + 8);                       \
+            __m512i b0 = _mm512_loadu_si512(bp + i);                           \
+            __m512i b1 = _mm512_loadu_si512(bp + i + 8);                       \
+                                                                               \
+            _mm512_storeu_si512(rp + i, a0 op b0);                             \
+            _mm512_storeu_si512(rp + i + 8, a1 op b1);                         \
+        }                                                                      \
+                                                                               \
+        for (; i < n; i += 8) {                                                \
+            __mmask8 m = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;              \
+            __m512i a = _mm512_maskz_loadu_epi64(m, ap + i);                   \
+            __m512i b = _mm512_maskz_loadu_epi64(m, bp + i);                   \
+                                                                               \
+            _mm512_mask_storeu_epi64(rp + i, m, a op b);                       \
+        }                                                                      \
+    }
+
+MP_DEFINE_BIT_N_AVX512(and, &)
+MP_DEFINE_BIT_N_AVX512(or, |)
+MP_DEFINE_BIT_N_AVX512(xor, ^)
+
+MP_TARGET_AVX512 void mp_bit_not_avx512(
+    const mp_uint *ap, mp_size an, mp_uint *rp)
+{
+    MP_EXPECTS(an);
+
+    __m512i ones = _mm512_set1_epi64(-1);
+    mp_size i = 0;
+
+    for (; i + 16 <= an; i += 16) {
+        __m512i a0 = _mm512_loadu_si512(ap + i);
+        __m512i a1 = _mm512_loadu_si512(ap + i + 8);
+
+        _mm512_storeu_si512(rp + i, a0 ^ ones);
+        _mm512_storeu_si512(rp + i + 8, a1 ^ ones);
+    }
+
+    for (; i < an; i += 8) {
+        __mmask8 m = an - i >= 8 ? 0xff : (1u << (an - i)) - 1;
+        __m512i a = _mm512_maskz_loadu_epi64(m, ap + i);
+
+        _mm512_mask_storeu_epi64(rp + i, m, a ^ ones);
+    }
+}
+
+MP_TARGET_AVX512 static inline __m512i mp_popcount_512(__m512i v)
+{
+    __m512i lookup = _mm512_broadcast_i32x4(_mm_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4));
+    __m512i nibble = _mm512_set1_epi8(0x0f);
+    __m512i lo = _mm512_shuffle_epi8(lookup, v & nibble);
+    __m512i hi = _mm512_shuffle_epi8(
+        lookup, _mm512_srli_epi16(v, 4) & nibble);
+
+    return _mm512_sad_epu8(_mm512_add_epi8(lo, hi), _mm512_setzero_si512());
+}
+
+// vpternlogq computes the carry, the majority of a, b and c, as 0xe8 and the
+// sum, their parity, as 0x96
+
+#define MP_CSA_512(h, l, a, b, c)                                              \
+    do {                                                                       \
+        __m512i x = (a);                                                       \
+        __m512i y = (b);                                                       \
+        __m512i z = (c);                                                       \
+                                                                               \
+        (h) = _mm512_ternarylogic_epi64(x, y, z, 0xe8);                        \
+        (l) = _mm512_ternarylogic_epi64(x, y, z, 0x96);                        \
+    } while (0)
+
+// Loads the limbs i to i + 7 of a, or of a ^ b when b is given, that are set
+// in the mask m. The others read as zero.
+
+MP_TARGET_AVX512 static inline __m512i mp_load_512(
+    const mp_uint *ap, const mp_uint *bp, mp_size i, __mmask8 m)
+{
+    __m512i v = _mm512_maskz_loadu_epi64(m, ap + i);
+
+    if (bp) {
+        v ^= _mm512_maskz_loadu_epi64(m, bp + i);
+    }
+
+    return v;
+}
+
+MP_TARGET_AVX512 static inline mp_size mp_hamming_avx512_impl(
+    const mp_uint *ap, const mp_uint *bp, mp_size n)
+{
+    __m512i total = _mm512_setzero_si512();
+    __m512i ones = _mm512_setzero_si512();
+    __m512i twos = _mm512_setzero_si512();
+    __m512i fours = _mm512_setzero_si512();
+    __m512i eights = _mm512_setzero_si512();
+    __m512i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+    mp_size i = 0;
+
+    for (; i + 128 <= n; i += 128) {
+        MP_CSA_512(twos_a, ones, ones, mp_load_512(ap, bp, i, 0xff),
+                   mp_load_512(ap, bp, i + 8, 0xff));
+        MP_CSA_512(twos_b, ones, ones, mp_load_512(ap, bp, i + 16, 0xff),
+                   mp_load_512(ap, bp, i + 24, 0xff));
+        MP_CSA_512(fours_a, twos, twos, twos_a, twos_b);
+        MP_CSA_512(twos_a, ones, ones, mp_load_512(ap, bp, i + 32, 0xff),
+                   mp_load_512(ap, bp, i + 40, 0xff));
+        MP_CSA_512(twos_b, ones, ones, mp_load_512(ap, bp, i + 48, 0xff),
+                   mp_load_512(ap, bp, i + 56, 0xff));
+        MP_CSA_512(fours_b, twos, twos, twos_a, twos_b);
+        MP_CSA_512(eights_a, fours, fours, fours_a, fours_b);
+        MP_CSA_512(twos_a, ones, ones, mp_load_512(ap, bp, i + 64, 0xff),
+                   mp_load_512(ap, bp, i + 72, 0xff));
+        MP_CSA_512(twos_b, ones, ones, mp_load_512(ap, bp, i + 80, 0xff),
+                   mp_load_512(ap, bp, i + 88, 0xff));
+        MP_CSA_512(fours_a, twos, twos, twos_a, twos_b);
+        MP_CSA_512(twos_a, ones, ones, mp_load_512(ap, bp, i + 96, 0xff),
+                   mp_load_512(ap, bp, i + 104, 0xff));
+        MP_CSA_512(twos_b, ones, ones, mp_load_512(ap, bp, i + 112, 0xff),
+                   mp_load_512(ap, bp, i + 120, 0xff));
+        MP_CSA_512(fours_b, twos, twos, twos_a, twos_b);
+        MP_CSA_512(eights_b, fours, fours, fours_a, fours_b);
+        MP_CSA_512(sixteens, eights, eights, eights_a, eights_b);
+
+        total = _mm512_add_epi64(total, mp_popcount_512(sixteens));
+    }
+
+    total = _mm512_slli_epi64(total, 4);
+    total = _mm512_add_epi64(
+        total, _mm512_slli_epi64(mp_popcount_512(eights), 3));
+    total = _mm512_add_epi64(
+        total, _mm512_slli_epi64(mp_popcount_512(fours), 2));
+    total = _mm512_add_epi64(
+        total, _mm512_slli_epi64(mp_popcount_512(twos), 1));
+    total = _mm512_add_epi64(total, mp_popcount_512(ones));
+
+    for (; i < n; i += 8) {
+        __mmask8 m = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+
+        total = _mm512_add_epi64(
+            total, mp_popcount_512(mp_load_512(ap, bp, i, m)));
+    }
+
+    return _mm512_reduce_add_epi64(total);
+}
+
+MP_TARGET_AVX512 mp_size mp_popcount_avx512(const mp_uint *ap, mp_size an)
+{
+    MP_EXPECTS(an);
+
+    return mp_hamming_avx512_impl(ap, NULL, an);
+}
+
+MP_TARGET_AVX512 mp_size mp_hamming_n_avx512(
+    const mp_uint *ap, const mp_uint *bp, mp_size n)
+{
+    MP_EXPECTS(n);
+
+    return mp_hamming_avx512_impl(ap, bp, n);
+}
+
+#endif
@@ -0,0 +1,131 @@
+#include <mp/bigint.h>
+#include <mp/mp.h>
+#include "./test.h"
+
+// mp_bigint_addmul and mp_bigint_submul against a separate product and sum,
+// for every sign of r, a and b. Short r makes the sum change sign, and b at
+// the Karatsuba threshold and above goes through the scratch product.
+
+static void mp_test_addmul_sizes(mp_size rn, mp_size an, mp_size bn)
+{
+    struct mp_bigint r, a, b, p, e, x;
+
+    mp_bigint_construct(&r, NULL);
+    mp_bigint_construct(&a, NULL);
+    mp_bigint_construct(&b, NULL);
+    mp_bigint_construct(&p, NULL);
+    mp_bigint_construct(&e, NULL);
+    mp_bigint_construct(&x, NULL);
+
+    for (int signs = 0; signs < 8; signs++) {
+        if (rn) {
+            mp_test_bigint_rand(&r, rn, signs & 1);
+        } else {
+            MP_CHECK(!mp_bigint_assign_uint(&r, 0));
+        }
+
+        mp_test_bigint_rand(&a, an, signs & 2);
+        mp_test_bigint_rand(&b, bn, signs & 4);
+        MP_CHECK(!mp_bigint_mul(&a, &b, &p));
+
+        mp_test_bigint_add(&r, &p, &e);
+        MP_CHECK(!mp_bigint_assign_copy(&x, &r));
+        MP_CHECK(!mp_bigint_addmul(&a, &b, &x));
+        MP_CHECK(mp_bigint_equal(&x, &e));
+
+        mp_bigint_negate(&p);
+        mp_test_bigint_add(&r, &p, &e);
+        MP_CHECK(!mp_bigint_assign_copy(&x, &r));
+        MP_CHECK(!mp_bigint_submul(&a, &b, &x));
+        MP_CHECK(mp_bigint_equal(&x, &e));
+
+        // r aliasing a
+        MP_CHECK(!mp_bigint_mul(&a, &b, &p));
+        mp_test_bigint_add(&a, &p, &e);
+        MP_CHECK(!mp_bigint_assign_copy(&x, &a));
+        MP_CHECK(!mp_bigint_addmul(&x, &b, &x));
+        MP_CHECK(mp_bigint_equal(&x, &e));
+
+        // r = a b, which cancels to zero
+        MP_CHECK(!mp_bigint_assign_copy(&x, &p));
+        MP_CHECK(!mp_bigint_submul(&a, &b, &x));
+        MP_CHECK(!mp_bigint_sign(&x));
+    }
+
+    mp_bigint_destruct(&r);
+    mp_bigint_destruct(&a);
+    mp_bigint_destruct(&b);
+    mp_bigint_destruct(&p);
+    mp_bigint_destruct(&e);
+    mp_bigint_destruct(&x);
+}
+
+static void mp_test_addmul_uint_sizes(mp_size rn, mp_size an)
+{
+    struct mp_bigint r, a, b, p, e, x;
+    mp_uint u = mp_test_rand() | 1;
+
+    mp_bigint_construct(&r, NULL);
+    mp_bigint_construct(&a, NULL);
+    MP_CHECK(!mp_bigint_construct_uint(&b, u, NULL));
+    mp_bigint_construct(&p, NULL);
+    mp_bigint_construct(&e, NULL);
+    mp_bigint_construct(&x, NULL);
+
+    for (int signs = 0; signs < 4; signs++) {
+        if (rn) {
+            mp_test_bigint_rand(&r, rn, signs & 1);
+        } else {
+            MP_CHECK(!mp_bigint_assign_uint(&r, 0));
+        }
+
+        mp_test_bigint_rand(&a, an, signs & 2);
+        MP_CHECK(!mp_bigint_mul(&a, &b, &p));
+
+        mp_test_bigint_add(&r, &p, &e);
+        MP_CHECK(!mp_bigint_assign_copy(&x, &r));
+        MP_CHECK(!mp_bigint_addmul_uint(&a, u, &x));
+        MP_CHECK(mp_bigint_equal(&x, &e));
+
+        mp_bigint_negate(&p);
+        mp_test_bigint_add(&r, &p, &e);
+        MP_CHECK(!mp_bigint_assign_copy(&x, &r));
+        MP_CHECK(!mp_bigint_submul_uint(&a, u, &x));
+        MP_CHECK(mp_bigint_equal(&x, &e));
+    }
+
+    mp_bigint_destruct(&r);
+    mp_bigint_destruct(&a);
+    mp_bigint_destruct(&b);
+    mp_bigint_destruct(&p);
+    mp_bigint_destruct(&e);
+    mp_bigint_destruct(&x);
+}
+
+int main(void)
+{
+    static const mp_size sizes[] = {1, 2, 3, 5, 8};
+
+    for (mp_size i = 0; i < 5; i++) {
+        for (mp_size j = 0; j <= i; j++) {
+            mp_size an = sizes[i];
+            mp_size bn = sizes[j];
+
+            mp_test_addmul_sizes(0, an, bn);
+            mp_test_addmul_sizes(1, an, bn);
+            mp_test_addmul_sizes(an + bn - 1, an, bn);
+            mp_test_addmul_sizes(an + bn + 2, an, bn);
+            mp_test_addmul_uint_sizes(0, an);
+            mp_test_addmul_uint_sizes(1, an);
+            mp_test_addmul_uint_sizes(an, an);
+            mp_test_addmul_uint_sizes(an + 3, an);
+        }
+    }
+
+    mp_test_addmul_sizes(10, MP_MUL_KARATSUBA_THRESHOLD + 20,
+                         MP_MUL_KARATSUBA_THRESHOLD);
+    mp_test_addmul_sizes(3 * MP_MUL_KARATSUBA_THRESHOLD,
+                         MP_MUL_KARATSUBA_THRESHOLD + 20,
+                         MP_MUL_KARATSUBA_THRESHOLD + 1);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+#include <mp/bigint.h>
+#include <mp/mp.h>
+#include "./test.h"
+
+// |a| < |b|
+
+static mp_bool mp_test_bigint_abs_less(
+    const struct mp_bigint *a, const struct mp_bigint *b)
+{
+    struct mp_bigint x, y;
+
+    MP_CHECK(!mp_bigint_construct_copy(&x, a, NULL));
+    MP_CHECK(!mp_bigint_construct_copy(&y, b, NULL));
+    mp_bigint_abs(&x);
+    mp_bigint_abs(&y);
+
+    mp_bool less = mp_bigint_cmp(&x, &y) < 0;
+
+    mp_bigint_destruct(&x);
+    mp_bigint_destruct(&y);
+    return less;
+}
+
+enum mp_test_round {
+    MP_TEST_ROUND_TRUNC,
+    MP_TEST_ROUND_FLOOR,
+    MP_TEST_ROUND_CEIL,
+};
+
+static enum mp_errc mp_test_bigint_div(
+    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *q,
+    struct mp_bigint *r, enum mp_test_round round)
+{
+    switch (round) {
+    case MP_TEST_ROUND_TRUNC:
+        return mp_bigint_tdiv(a, b, q, r);
+    case MP_TEST_ROUND_FLOOR:
+        return mp_bigint_fdiv(a, b, q, r);
+    default:
+        return mp_bigint_cdiv(a, b, q, r);
+    }
+}
+
+// Small operands against the C operators, with the quotient moved one away
+// from zero where floor and ceil differ from truncation
+
+static void mp_test_div_small(mp_int a, mp_int b)
+{
+    struct mp_bigint x, y, q, r;
+
+    MP_CHECK(!mp_bigint_construct_int(&x, a, NULL));
+    MP_CHECK(!mp_bigint_construct_int(&y, b, NULL));
+    mp_bigint_construct(&q, NULL);
+    mp_bigint_construct(&r, NULL);
+
+    for (int round = MP_TEST_ROUND_TRUNC; round <= MP_TEST_ROUND_CEIL;
+         round++) {
+        mp_int eq = a / b;
+        mp_int er = a % b;
+
+        if (er && round == MP_TEST_ROUND_FLOOR && (er < 0) != (b < 0)) {
+            eq -= 1;
+            er += b;
+        } else if (er && round == MP_TEST_ROUND_CEIL && (er < 0) == (b < 0)) {
+            eq += 1;
+            er -= b;
+        }
+
+        MP_CHECK(!mp_test_bigint_div(&x, &y, &q, &r, round));
+        MP_CHECK(mp_bigint_equal_int(&q, eq));
+        MP_CHECK(mp_bigint_equal_int(&r, er));
+
+        MP_CHECK(!mp_test_bigint_div(&x, &y, &q, NULL, round));
+        MP_CHECK(mp_bigint_equal_int(&q, eq));
+        MP_CHECK(!mp_test_bigint_div(&x, &y, NULL, &r, round));
+        MP_CHECK(mp_bigint_equal_int(&r, er));
+    }
+
+    mp_bigint_destruct(&x);
+    mp_bigint_destruct(&y);
+    mp_bigint_destruct(&q);
+    mp_bigint_destruct(&r);
+}
+
+// Larger operands, checked as a = q b + r with |r| < |b| and r taking the
+// sign the rounding calls for
+
+static void mp_test_div_large(mp_size an, mp_bool aneg, mp_size bn,
+                              mp_bool bneg)
+{
+    struct mp_bigint a, b, q, r, e;
+
+    mp_bigint_construct(&a, NULL);
+    mp_bigint_construct(&b, NULL);
+    mp_bigint_construct(&q, NULL);
+    mp_bigint_construct(&r, NULL);
+    mp_bigint_construct(&e, NULL);
+    mp_test_bigint_rand(&a, an, aneg);
+    mp_test_bigint_rand(&b, bn, bneg);
+
+    for (int round = MP_TEST_ROUND_TRUNC; round <= MP_TEST_ROUND_CEIL;
+         round++) {
+        int sign = round == MP_TEST_ROUND_TRUNC   ? mp_bigint_sign(&a)
+                   : round == MP_TEST_ROUND_FLOOR ? mp_bigint_sign(&b)
+                                                  : -mp_bigint_sign(&b);
+
+        MP_CHECK(!mp_test_bigint_div(&a, &b, &q, &r, round));
+        MP_CHECK(mp_test_bigint_abs_less(&r, &b));
+        MP_CHECK(!mp_bigint_sign(&r) || mp_bigint_sign(&r) == sign);
+
+        MP_CHECK(!mp_bigint_mul(&q, &b, &e));
+        mp_test_bigint_add(&e, &r, &e);
+        MP_CHECK(mp_bigint_equal(&e, &a));
+    }
+
+    mp_bigint_destruct(&a);
+    mp_bigint_destruct(&b);
+    mp_bigint_destruct(&q);
+    mp_bigint_destruct(&r);
+    mp_bigint_destruct(&e);
+}
+
+static void mp_test_div(void)
+{
+    for (mp_int a = -9; a <= 9; a++) {
+        for (mp_int b = -4; b <= 4; b++) {
+            if (b) {
+                mp_test_div_small(a, b);
+            }
+        }
+    }
+
+    for (int i = 0; i < 100; i++) {
+        mp_int a = (mp_int)(mp_test_rand() >> 2) - ((mp_int)1 << 61);
+        mp_int b = (mp_int)(mp_test_rand() >> (2 + mp_test_rand() % 60));
+
+        mp_test_div_small(a, b ? b : 1);
+        mp_test_div_small(a, b ? -b : -1);
+    }
+
+    for (mp_size an = 1; an <= 6; an++) {
+        for (mp_size bn = 1; bn <= an + 1; bn++) {
+            for (int signs = 0; signs < 4; signs++) {
+                mp_test_div_large(an, signs & 1, bn, signs & 2);
+            }
+        }
+    }
+
+    for (int signs = 0; signs < 4; signs++) {
+        mp_test_div_large(150, signs & 1, 70, signs & 2);
+    }
+}
+
+// x = odd 2^e, negative if neg
+
+static void mp_test_bigint_odd_2exp(struct mp_bigint *x, mp_size e, mp_bool neg)
+{
+    struct mp_bigint y;
+
+    MP_CHECK(!mp_bigint_assign_uint(x, mp_test_rand() | 1));
+    MP_CHECK(!mp_bigint_construct_uint(&y, (mp_uint)1 << 32, NULL));
+
+    for (; e >= 32; e -= 32) {
+        MP_CHECK(!mp_bigint_mul(x, &y, x));
+    }
+
+    MP_CHECK(!mp_bigint_assign_uint(&y, (mp_uint)1 << e));
+    MP_CHECK(!mp_bigint_mul(x, &y, x));
+
+    if (neg) {
+        mp_bigint_negate(x);
+    }
+
+    mp_bigint_destruct(&y);
+}
+
+static void mp_test_divisible_2exp(void)
+{
+    struct mp_bigint x;
+
+    mp_bigint_construct(&x, NULL);
+
+    for (mp_size e = 0; e <= 4 * MP_UINT_WIDTH; e++) {
+        mp_size ks[] = {0, e ? e - 1 : 0, e, e + 1, 6 * MP_UINT_WIDTH};
+
+        for (int neg = 0; neg < 2; neg++) {
+            mp_test_bigint_odd_2exp(&x, e, neg);
+
+            for (mp_size i = 0; i < sizeof(ks) / sizeof(ks[0]); i++) {
+                MP_CHECK(mp_bigint_divisible_2exp(&x, ks[i]) == (ks[i] <= e));
+            }
+        }
+    }
+
+    MP_CHECK(!mp_bigint_assign_uint(&x, 0));
+
+    for (mp_size k = 0; k <= 3 * MP_UINT_WIDTH; k += 7) {
+        MP_CHECK(mp_bigint_divisible_2exp(&x, k));
+    }
+
+    mp_bigint_destruct(&x);
+}
+
+int main(void)
+{
+    mp_test_div();
+    mp_test_divisible_2exp();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+#include <mp/mp.h>
+#include "./test.h"
+
+// Byte conversion against bytes taken from the limbs one at a time, in both
+// orders, under the portable kernels and under all of the CPU's features.
+// Lengths run past several vectors with every remainder, for the tails.
+
+#define MP_TEST_LIMBS 13
+#define MP_TEST_BYTES (MP_TEST_LIMBS * sizeof(mp_uint))
+
+static mp_byte mp_test_byte(const mp_uint *ap, mp_size i)
+{
+    return (mp_byte)(ap[i / sizeof(mp_uint)] >> i % sizeof(mp_uint) * 8);
+}
+
+// The count low bytes of a, in the given order
+
+static void mp_test_bytes_ref(const mp_uint *ap, mp_size count,
+                              mp_byte *bytes, enum mp_endian endian)
+{
+    for (mp_size i = 0; i < count; i++) {
+        mp_size j = endian == MP_ENDIAN_LITTLE ? i : count - 1 - i;
+
+        bytes[j] = mp_test_byte(ap, i);
+    }
+}
+
+// a of width bytes, which the padded output must place at the low end and
+// fill up to byte_count with zeros, writing nothing past it
+
+static void mp_test_padded(const mp_uint *ap, mp_size an, mp_size width,
+                           mp_size byte_count, enum mp_endian endian)
+{
+    mp_byte bytes[MP_TEST_BYTES + 16];
+    mp_byte ep[MP_TEST_BYTES + 16];
+    mp_size pad = byte_count - width;
+
+    memset(bytes, 0xaa, sizeof(bytes));
+    memset(ep, 0, byte_count);
+    ep[byte_count] = 0xaa;
+    mp_test_bytes_ref(
+        ap, width, endian == MP_ENDIAN_LITTLE ? ep : ep + pad, endian);
+
+    MP_CHECK(!mp_to_bytes_padded(ap, an, bytes, byte_count, endian));
+    MP_CHECK(!memcmp(bytes, ep, byte_count + 1));
+}
+
+static void mp_test_to_bytes(enum mp_endian endian)
+{
+    mp_uint ap[MP_TEST_LIMBS];
+    mp_byte bytes[MP_TEST_BYTES + 16];
+    mp_byte ep[MP_TEST_BYTES];
+
+    for (mp_size width = 1; width <= MP_TEST_BYTES; width++) {
+        mp_size an = (width - 1) / sizeof(mp_uint) + 1;
+        mp_size top = width % sizeof(mp_uint) * 8;
+
+        // width bytes exactly, with zero limbs above them
+        mp_test_fill(ap, MP_TEST_LIMBS);
+        memset(ap + an, 0, (MP_TEST_LIMBS - an) * sizeof(mp_uint));
+        ap[an - 1] &= top ? ((mp_uint)1 << top) - 1 : ~(mp_uint)0;
+        ap[an - 1] |= (mp_uint)1 << (top ? top - 1 : MP_UINT_WIDTH - 1);
+
+        mp_test_bytes_ref(ap, width, ep, endian);
+        MP_CHECK(mp_to_bytes(ap, MP_TEST_LIMBS, bytes, endian) == width);
+        MP_CHECK(!memcmp(bytes, ep, width));
+
+        mp_test_padded(ap, MP_TEST_LIMBS, width, width, endian);
+        mp_test_padded(ap, an, width, width + 1, endian);
+        mp_test_padded(ap, an, width, width + 13, endian);
+        mp_test_padded(ap, an, width, MP_TEST_BYTES + 8, endian);
+
+        MP_CHECK(mp_to_bytes_padded(ap, an, bytes, width - 1, endian) ==
+                 MP_ERRC_VALUE_TOO_LARGE);
+    }
+
+    // zero takes no bytes, and pads to all zeros
+    memset(ap, 0, sizeof(ap));
+    MP_CHECK(!mp_to_bytes(ap, MP_TEST_LIMBS, bytes, endian));
+    mp_test_padded(ap, MP_TEST_LIMBS, 0, 0, endian);
+    mp_test_padded(ap, MP_TEST_LIMBS, 0, 37, endian);
+}
+
+static void mp_test_from_bytes(enum mp_endian endian)
+{
+    mp_uint ap[MP_TEST_LIMBS];
+    mp_byte bytes[MP_TEST_BYTES];
+
+    for (mp_size count = 0; count <= MP_TEST_BYTES; count++) {
+        mp_size rn = (count + sizeof(mp_uint) - 1) / sizeof(mp_uint);
+        mp_uint *rp = mp_test_alloc(rn);
+        mp_size size = rn;
+
+        mp_test_fill(ap, MP_TEST_LIMBS);
+
+        if (count % sizeof(mp_uint)) {
+            ap[rn - 1] &= ((mp_uint)1 << count % sizeof(mp_uint) * 8) - 1;
+        }
+
+        while (size && !ap[size - 1]) {
+            size--;
+        }
+
+        mp_test_bytes_ref(ap, count, bytes, endian);
+        MP_CHECK(mp_from_bytes(bytes, count, rp, endian) == size);
+        MP_CHECK(mp_test_equal(rp, ap, size));
+
+        for (mp_size i = size; i < rn; i++) {
+            MP_CHECK(!rp[i]);
+        }
+
+        free(rp);
+    }
+}
+
+static void mp_test_bytes(void)
+{
+    enum mp_endian endians[] = {MP_ENDIAN_LITTLE, MP_ENDIAN_BIG};
+
+    for (mp_size i = 0; i < 2; i++) {
+        mp_test_to_bytes(endians[i]);
+        mp_test_from_bytes(endians[i]);
+    }
+}
+
+int main(void)
+{
+    unsigned prev = mp_set_kernel_features(0);
+
+    mp_test_bytes();
+    mp_set_kernel_features(mp_get_cpu_features());
+    mp_test_bytes();
+    mp_set_kernel_features(prev);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,306 @@
+#include <mp/mp.h>
+#include "./test.h"
+
+// Division checked by multiplying back with the schoolbook product: n must be
+// q d + r with r < d. Sizes cover the basecase, the divide and conquer and
+// Newton thresholds, and the prepared divisor's inverse threshold.
+
+static const mp_size mp_test_sizes[] = {
+    1, 2, 3, 4, 7, 31, 32, 33, 63, 64, 65, 100, 127, 128, 129, 200,
+};
+
+static void mp_test_check_div(const mp_uint *np, mp_size nn,
+                              const mp_uint *dp, mp_size dn,
+                              const mp_uint *qp, const mp_uint *rp)
+{
+    mp_size qn = nn - dn + 1;
+    mp_uint *ep = mp_test_alloc(nn + 1);
+
+    MP_CHECK(mp_cmp(rp, dn, dp, dn) < 0);
+    mp_test_mul(qp, qn, dp, dn, ep);
+    MP_CHECK(!ep[nn]);
+    MP_CHECK(!mp_add(ep, nn, rp, dn, ep));
+    MP_CHECK(mp_test_equal(ep, np, nn));
+
+    free(ep);
+}
+
+static void mp_test_div_sizes(mp_size nn, mp_size dn)
+{
+    mp_size qn = nn - dn + 1;
+    mp_uint *np = mp_test_alloc(nn);
+    mp_uint *dp = mp_test_alloc(dn);
+    mp_uint *qp = mp_test_alloc(qn);
+    mp_uint *rp = mp_test_alloc(dn);
+    mp_uint *q2p = mp_test_alloc(qn);
+    mp_uint *r2p = mp_test_alloc(dn);
+    struct mp_divisor div;
+
+    mp_test_fill(np, nn);
+    mp_test_fill_top(dp, dn);
+
+    MP_CHECK(!mp_div(np, nn, dp, dn, qp, rp));
+    mp_test_check_div(np, nn, dp, dn, qp, rp);
+
+    MP_CHECK(!mp_mod(np, nn, dp, dn, r2p));
+    MP_CHECK(mp_test_equal(r2p, rp, dn));
+
+    MP_CHECK(!mp_divisor_construct(&div, dp, dn, NULL));
+    MP_CHECK(!mp_div_pre(np, nn, &div, q2p, r2p));
+    MP_CHECK(mp_test_equal(q2p, qp, qn));
+    MP_CHECK(mp_test_equal(r2p, rp, dn));
+    MP_CHECK(!mp_mod_pre(np, nn, &div, r2p));
+    MP_CHECK(mp_test_equal(r2p, rp, dn));
+    mp_divisor_destruct(&div);
+
+    free(np);
+    free(dp);
+    free(qp);
+    free(rp);
+    free(q2p);
+    free(r2p);
+}
+
+static void mp_test_div(void)
+{
+    mp_size count = sizeof(mp_test_sizes) / sizeof(mp_test_sizes[0]);
+
+    for (mp_size i = 0; i < count; i++) {
+        mp_size dn = mp_test_sizes[i];
+
+        mp_test_div_sizes(dn, dn);
+        mp_test_div_sizes(dn + 1, dn);
+        mp_test_div_sizes(2 * dn, dn);
+        mp_test_div_sizes(3 * dn + 7, dn);
+    }
+
+    mp_test_div_sizes(2 * MP_DIVISOR_INVERT_THRESHOLD + 9,
+                      MP_DIVISOR_INVERT_THRESHOLD + 3);
+    mp_test_div_sizes(2 * MP_DIV_NEWTON_THRESHOLD + 5,
+                      MP_DIV_NEWTON_THRESHOLD + 1);
+}
+
+// mp_invert against its definition: r = floor((B^2n - 1) / a) - B^n exactly
+// when a (B^n + r) < B^2n <= a (B^n + r + 1)
+
+static void mp_test_check_invert(const mp_uint *ap, mp_size an)
+{
+    mp_uint *rp = mp_test_alloc(an);
+    mp_uint *ep = mp_test_alloc(2 * an);
+
+    MP_CHECK(!mp_invert(ap, an, rp));
+    mp_test_mul(ap, an, rp, an, ep);
+    MP_CHECK(!mp_add_n(ep + an, ap, an, ep + an));
+    MP_CHECK(mp_add(ep, 2 * an, ap, an, ep));
+
+    free(rp);
+    free(ep);
+}
+
+static void mp_test_invert(void)
+{
+    mp_size t = MP_INVERT_THRESHOLD;
+    mp_size sizes[] = {1, 2, 3, 5, t - 1, t, t + 1, 2 * t + 3, 5 * t - 1};
+
+    for (mp_size i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        mp_size an = sizes[i];
+        mp_uint *ap = mp_test_alloc(an);
+        mp_uint *rp = mp_test_alloc(an);
+
+        mp_test_fill(ap, an);
+        ap[an - 1] |= (mp_uint)1 << (MP_UINT_WIDTH - 1);
+        mp_test_check_invert(ap, an);
+
+        // all ones, where r = 1
+        memset(ap, 0xff, an * sizeof(mp_uint));
+        mp_test_check_invert(ap, an);
+        MP_CHECK(!mp_invert(ap, an, rp));
+        MP_CHECK(rp[0] == 1);
+
+        for (mp_size j = 1; j < an; j++) {
+            MP_CHECK(!rp[j]);
+        }
+
+        // B^n / 2, where r = B^n - 1
+        memset(ap, 0, an * sizeof(mp_uint));
+        ap[an - 1] = (mp_uint)1 << (MP_UINT_WIDTH - 1);
+        mp_test_check_invert(ap, an);
+        MP_CHECK(!mp_invert(ap, an, rp));
+
+        for (mp_size j = 0; j < an; j++) {
+            MP_CHECK(rp[j] == MP_UINT_MAX);
+        }
+
+        free(ap);
+        free(rp);
+    }
+}
+
+// mp_div_uint once stored the quotient one limb off and shifted the
+// remainder wrong for divisors without the top bit, and never returned for a
+// single limb
+
+static void mp_test_div_uint(void)
+{
+    for (mp_size nn = 1; nn <= 12; nn++) {
+        for (mp_size shift = 0; shift < MP_UINT_WIDTH; shift += 3) {
+            mp_uint np[12], qp[12], ep[13];
+            mp_uint d = (mp_test_rand() | (mp_uint)1 << 63) >> shift;
+
+            mp_test_fill(np, nn);
+
+            mp_uint r = mp_div_uint(np, nn, d, qp);
+
+            MP_CHECK(r < d);
+            MP_CHECK(mp_mod_uint(np, nn, d) == r);
+            mp_test_mul(qp, nn, &d, 1, ep);
+            MP_CHECK(!ep[nn]);
+            MP_CHECK(!mp_add_uint(ep, nn, r, ep));
+            MP_CHECK(mp_test_equal(ep, np, nn));
+        }
+    }
+}
+
+// Residues by many moduli at once against mp_mod_uint, pairs and an odd one
+// out, over operands of several blocks
+
+static void mp_test_mod_uint_multi(void)
+{
+    mp_size b = MP_MOD_UINT_MULTI_BLOCK;
+    mp_size sizes[] = {1, 2, b - 1, b, b + 1, 3 * b + 5};
+    mp_uint moduli[9], residues[9];
+    mp_uint *ap = mp_test_alloc(3 * b + 5);
+
+    moduli[0] = 1;
+    moduli[1] = MP_UINT_MAX;
+    moduli[2] = 3;
+    moduli[3] = (mp_uint)1 << 63;
+    moduli[4] = MP_UINT_MAX - 1;
+
+    for (mp_size j = 5; j < 9; j++) {
+        moduli[j] = mp_test_rand() >> (mp_test_rand() % 64) | 1;
+    }
+
+    for (mp_size i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        mp_size an = sizes[i];
+
+        mp_test_fill(ap, an);
+
+        for (mp_size k = 1; k <= 9; k++) {
+            mp_mod_uint_multi(ap, an, moduli, k, residues);
+
+            for (mp_size j = 0; j < k; j++) {
+                MP_CHECK(residues[j] == mp_mod_uint(ap, an, moduli[j]));
+            }
+        }
+
+        // MP_UINT_MAX as the odd one out, against the sum of the limbs, as
+        // B = 1 mod B - 1
+        mp_test_uint2 sum = 0;
+
+        for (mp_size j = 0; j < an; j++) {
+            sum += ap[j];
+        }
+
+        mp_mod_uint_multi(ap, an, moduli + 1, 1, residues);
+        MP_CHECK(residues[0] == sum % MP_UINT_MAX);
+        MP_CHECK(!mp_mod_uint(ap, an, 1));
+    }
+
+    free(ap);
+}
+
+// n = odd 2^e is divisible by 2^k exactly when k <= e, with k and e on and
+// next to limb boundaries and k past the top of n. Zero limbs are divisible
+// by any power.
+
+static void mp_test_divisible_2exp(void)
+{
+    for (mp_size nn = 1; nn <= 4; nn++) {
+        mp_size bits = nn * MP_UINT_WIDTH;
+        mp_uint np[4];
+
+        for (mp_size e = 0; e < bits; e++) {
+            if (e % MP_UINT_WIDTH > 1 && e % MP_UINT_WIDTH < 62) {
+                continue;
+            }
+
+            mp_size ks[] = {
+                0,    e ? e - 1 : 0, e,        e + 1,
+                bits, bits - 1,      bits + 1, 10 * bits,
+                (e / MP_UINT_WIDTH + 1) * MP_UINT_WIDTH,
+            };
+
+            mp_test_fill(np, nn);
+            memset(np, 0, e / MP_UINT_WIDTH * sizeof(mp_uint));
+            np[e / MP_UINT_WIDTH] &= ~(mp_uint)0 << e % MP_UINT_WIDTH;
+            np[e / MP_UINT_WIDTH] |= (mp_uint)1 << e % MP_UINT_WIDTH;
+
+            for (mp_size i = 0; i < sizeof(ks) / sizeof(ks[0]); i++) {
+                MP_CHECK(mp_divisible_2exp(np, nn, ks[i]) == (ks[i] <= e));
+            }
+        }
+
+        memset(np, 0, sizeof(np));
+
+        for (mp_size k = 0; k <= bits + MP_UINT_WIDTH; k++) {
+            MP_CHECK(mp_divisible_2exp(np, nn, k));
+        }
+    }
+}
+
+static void mp_test_divexact_sizes(mp_size qn, mp_size dn)
+{
+    mp_size nn = qn + dn;
+    mp_uint *qp = mp_test_alloc(qn);
+    mp_uint *dp = mp_test_alloc(dn);
+    mp_uint *np = mp_test_alloc(nn);
+    mp_uint *rp = mp_test_alloc(nn);
+
+    mp_test_fill_top(qp, qn);
+    mp_test_fill_top(dp, dn);
+    mp_test_mul(qp, qn, dp, dn, np);
+
+    // the product may not need its top limb
+    nn -= !np[nn - 1];
+
+    MP_CHECK(!mp_divexact(np, nn, dp, dn, rp));
+    MP_CHECK(mp_test_equal(rp, qp, qn));
+    MP_CHECK(nn < qn + dn || !rp[qn]);
+
+    if (dn == 1) {
+        mp_divexact_uint(np, nn, *dp, rp);
+        MP_CHECK(mp_test_equal(rp, qp, qn));
+        MP_CHECK(mp_divisible_uint(np, nn, *dp));
+    }
+
+    free(qp);
+    free(dp);
+    free(np);
+    free(rp);
+}
+
+static void mp_test_divexact(void)
+{
+    mp_size count = sizeof(mp_test_sizes) / sizeof(mp_test_sizes[0]);
+
+    for (mp_size i = 0; i < count; i++) {
+        mp_size dn = mp_test_sizes[i];
+
+        mp_test_divexact_sizes(1, dn);
+        mp_test_divexact_sizes(dn, dn);
+        mp_test_divexact_sizes(2 * dn + 3, dn);
+        mp_test_divexact_sizes(dn, 2 * dn + 3);
+    }
+}
+
+int main(void)
+{
+    mp_test_div();
+    mp_test_invert();
+    mp_test_div_uint();
+    mp_test_mod_uint_multi();
+    mp_test_divexact();
+    mp_test_divisible_2exp();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+#include <mp/mp.h>
+#include "./test.h"
+
+// Runs the same operations under every subset of the CPU's features, so
+// under every binding of the kernel table, and requires the same results as
+// under none, where every kernel is the portable one. Products are also
+// checked against the schoolbook product, and parsed digits against Horner's
+// rule.
+
+#define MP_TEST_OUT_SIZE (1 << 20)
+
+struct mp_test_out {
+    mp_uint *data;
+    mp_size size;
+};
+
+static mp_uint *mp_test_out_next(struct mp_test_out *out, mp_size n)
+{
+    MP_CHECK(out->size + n <= MP_TEST_OUT_SIZE);
+
+    mp_uint *p = out->data + out->size;
+
+    out->size += n;
+    return p;
+}
+
+static void mp_test_out_put(struct mp_test_out *out, mp_uint x)
+{
+    *mp_test_out_next(out, 1) = x;
+}
+
+static void mp_test_arith(struct mp_test_out *out, mp_size n)
+{
+    mp_uint ap[64], bp[64], ep[128];
+
+    mp_test_fill(ap, n);
+    mp_test_fill(bp, n);
+
+    mp_test_out_put(out, mp_add_n(ap, bp, n, mp_test_out_next(out, n)));
+    mp_test_out_put(out, mp_sub_n(ap, bp, n, mp_test_out_next(out, n)));
+    mp_test_out_put(out, mp_mul_uint(ap, n, *bp, mp_test_out_next(out, n)));
+
+    mp_uint *rp = mp_test_out_next(out, n);
+
+    memcpy(rp, bp, n * sizeof(mp_uint));
+    mp_test_out_put(out, mp_addmul_uint(ap, n, bp[n - 1], rp));
+    rp = mp_test_out_next(out, n);
+    memcpy(rp, bp, n * sizeof(mp_uint));
+    mp_test_out_put(out, mp_submul_uint(ap, n, bp[n - 1], rp));
+
+    for (mp_size bn = 1; bn <= n; bn += 1 + bn / 4) {
+        rp = mp_test_out_next(out, n + bn);
+        mp_mul(ap, n, bp, bn, rp);
+        mp_test_mul(ap, n, bp, bn, ep);
+        MP_CHECK(mp_test_equal(rp, ep, n + bn));
+    }
+
+    rp = mp_test_out_next(out, 2 * n);
+    mp_sqr(ap, n, rp);
+    mp_test_mul(ap, n, ap, n, ep);
+    MP_CHECK(mp_test_equal(rp, ep, 2 * n));
+}
+
+static void mp_test_bits(struct mp_test_out *out, mp_size n)
+{
+    mp_uint ap[64], bp[64];
+
+    mp_test_fill(ap, n);
+    mp_test_fill(bp, n);
+
+    mp_bit_and_n(ap, bp, n, mp_test_out_next(out, n));
+    mp_bit_or_n(ap, bp, n, mp_test_out_next(out, n));
+    mp_bit_xor_n(ap, bp, n, mp_test_out_next(out, n));
+    mp_bit_not(ap, n, mp_test_out_next(out, n));
+    mp_test_out_put(out, mp_popcount(ap, n));
+    mp_test_out_put(out, mp_hamming_distance(ap, n, bp, n));
+
+    for (mp_size bits = 1; bits < MP_UINT_WIDTH; bits += 13) {
+        mp_uint *rp = mp_test_out_next(out, n);
+
+        mp_test_out_put(out, mp_left_shift(ap, n, bits, rp));
+        rp = mp_test_out_next(out, n);
+        mp_test_out_put(out, mp_right_shift(ap, n, bits, rp));
+
+        // in place
+        rp = mp_test_out_next(out, n);
+        memcpy(rp, ap, n * sizeof(mp_uint));
+        mp_test_out_put(out, mp_left_shift(rp, n, bits, rp));
+        rp = mp_test_out_next(out, n);
+        memcpy(rp, ap, n * sizeof(mp_uint));
+        mp_test_out_put(out, mp_right_shift(rp, n, bits, rp));
+    }
+}
+
+static void mp_test_bytes(struct mp_test_out *out, mp_size n)
+{
+    enum mp_endian endians[] = {MP_ENDIAN_LITTLE, MP_ENDIAN_BIG};
+    mp_uint ap[64];
+    mp_byte bytes[64 * sizeof(mp_uint)];
+
+    mp_test_fill_top(ap, n);
+
+    for (mp_size i = 0; i < 2; i++) {
+        mp_size count = mp_to_bytes(ap, n, bytes, endians[i]);
+        mp_uint *rp = mp_test_out_next(out, n);
+
+        mp_test_out_put(out, count);
+        mp_test_out_put(out, mp_from_bytes(bytes, count, rp, endians[i]));
+        MP_CHECK(mp_test_equal(rp, ap, n));
+    }
+}
+
+// The value of n digits by Horner's rule in double limbs, independent of the
+// library, and its size
+
+static mp_size mp_test_parse(const char *s, mp_size n, int base, mp_uint *rp)
+{
+    mp_size rn = 0;
+
+    for (mp_size j = 0; j < n; j++) {
+        char c = s[j];
+        mp_uint d = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+
+        for (mp_size i = 0; i < rn; i++) {
+            mp_test_uint2 t = (mp_test_uint2)rp[i] * base + d;
+
+            rp[i] = (mp_uint)t;
+            d = (mp_uint)(t >> 64);
+        }
+
+        if (d) {
+            rp[rn++] = d;
+        }
+    }
+
+    return rn;
+}
+
+// Digits with a stray character at position n, which the scans must stop at,
+// on both sides of the divide and conquer threshold
+
+#define MP_TEST_DIGITS (20 * MP_FROM_STRING_DC_THRESHOLD)
+#define MP_TEST_DIGIT_LIMBS (MP_TEST_DIGITS / 16 + 1)
+
+static void mp_test_strings(struct mp_test_out *out, mp_size n)
+{
+    static const char digits[] = "0123456789abcdefABCDEF";
+    static const char stops[] = "g:/@G`\x80 ";
+    char s[MP_TEST_DIGITS + 2];
+    mp_uint ep[MP_TEST_DIGIT_LIMBS];
+    int bases[] = {10, 16};
+
+    for (mp_size i = 0; i < 2; i++) {
+        mp_size count = bases[i] == 10 ? 10 : 22;
+
+        for (mp_size j = 0; j < n; j++) {
+            s[j] = digits[mp_test_rand() % count];
+        }
+
+        s[0] = '1';
+        s[n] = stops[mp_test_rand() % (sizeof(stops) - 1)];
+        s[n + 1] = '7';
+
+        mp_size en = mp_test_parse(s, n, bases[i], ep);
+        mp_uint *rp = mp_test_out_next(out, MP_TEST_DIGIT_LIMBS);
+        struct mp_from_string_result result = mp_from_string(
+            s, s + n + 2, rp, MP_TEST_DIGIT_LIMBS, bases[i]);
+
+        MP_CHECK(!result.ec);
+        MP_CHECK(result.ptr == s + n);
+        MP_CHECK(result.size == en && mp_test_equal(rp, ep, en));
+        mp_test_out_put(out, result.size);
+    }
+}
+
+static void mp_test_all(struct mp_test_out *out)
+{
+    mp_test_state = 0x9e3779b97f4a7c15;
+    out->size = 0;
+
+    for (mp_size n = 1; n <= 64; n++) {
+        mp_test_arith(out, n);
+        mp_test_bits(out, n);
+        mp_test_bytes(out, n);
+    }
+
+    for (mp_size n = 1; n <= MP_TEST_DIGITS; n += 1 + n / 8) {
+        mp_test_strings(out, n);
+    }
+
+    // a limb of digits is 16 in hex and 19 in decimal
+    for (mp_size k = 16; k <= 19; k += 3) {
+        mp_test_strings(out, k * MP_FROM_STRING_DC_THRESHOLD - 1);
+        mp_test_strings(out, k * MP_FROM_STRING_DC_THRESHOLD);
+        mp_test_strings(out, k * MP_FROM_STRING_DC_THRESHOLD + 1);
+    }
+}
+
+int main(void)
+{
+    unsigned cpu = mp_get_cpu_features();
+    unsigned prev = mp_set_kernel_features(0);
+    struct mp_test_out generic = {mp_test_alloc(MP_TEST_OUT_SIZE), 0};
+    struct mp_test_out out = {mp_test_alloc(MP_TEST_OUT_SIZE), 0};
+
+    mp_test_all(&generic);
+
+    // every nonempty subset of cpu
+    for (unsigned features = cpu; features; features = (features - 1) & cpu) {
+        mp_set_kernel_features(features);
+        MP_CHECK(mp_get_kernel_features() == features);
+        mp_test_all(&out);
+        MP_CHECK(out.size == generic.size);
+        MP_CHECK(mp_test_equal(out.data, generic.data, out.size));
+    }
+
+    mp_set_kernel_features(prev);
+    free(generic.data);
+    free(out.data);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,371 @@
+#include <mp/bigint.h>
+#include <mp/mp.h>
+#include "./test.h"
+
+// mp_mul and mp_sqr against the schoolbook product, on both sides of every
+// tier threshold, balanced and unbalanced, and through both FFT backends
+
+static const mp_size mp_test_sizes[] = {
+    1,   2,   3,   4,   5,   8,   15,  16,  17,  31,  32,  33,  47,
+    48,  49,  63,  64,  65,  95,  96,  97,  127, 159, 160, 161, 200,
+};
+
+static void mp_test_mul_sizes(mp_size an, mp_size bn)
+{
+    mp_uint *ap = mp_test_alloc(an);
+    mp_uint *bp = mp_test_alloc(bn);
+    mp_uint *rp = mp_test_alloc(an + bn);
+    mp_uint *ep = mp_test_alloc(an + bn);
+
+    mp_test_fill_top(ap, an);
+    mp_test_fill_top(bp, bn);
+    mp_test_mul(ap, an, bp, bn, ep);
+
+    MP_CHECK(mp_mul(ap, an, bp, bn, rp) == ep[an + bn - 1]);
+    MP_CHECK(mp_test_equal(rp, ep, an + bn));
+
+    free(ap);
+    free(bp);
+    free(rp);
+    free(ep);
+}
+
+static void mp_test_sqr_size(mp_size an)
+{
+    mp_uint *ap = mp_test_alloc(an);
+    mp_uint *rp = mp_test_alloc(2 * an);
+    mp_uint *ep = mp_test_alloc(2 * an);
+
+    mp_test_fill_top(ap, an);
+    mp_test_mul(ap, an, ap, an, ep);
+
+    MP_CHECK(mp_sqr(ap, an, rp) == ep[2 * an - 1]);
+    MP_CHECK(mp_test_equal(rp, ep, 2 * an));
+
+    // all one limbs give the largest carries
+    memset(ap, 0xff, an * sizeof(mp_uint));
+    mp_test_mul(ap, an, ap, an, ep);
+    mp_sqr(ap, an, rp);
+    MP_CHECK(mp_test_equal(rp, ep, 2 * an));
+
+    free(ap);
+    free(rp);
+    free(ep);
+}
+
+static void mp_test_mul_tiers(void)
+{
+    mp_size count = sizeof(mp_test_sizes) / sizeof(mp_test_sizes[0]);
+
+    for (mp_size i = 0; i < count; i++) {
+        mp_size bn = mp_test_sizes[i];
+
+        mp_test_mul_sizes(bn, bn);
+        mp_test_mul_sizes(bn + 1, bn);
+        mp_test_mul_sizes(2 * bn, bn);
+        mp_test_mul_sizes(3 * bn + 5, bn);
+        mp_test_mul_sizes(7 * bn, bn);
+        mp_test_sqr_size(bn);
+    }
+}
+
+static void mp_test_mul_fft(void)
+{
+    enum mp_mul_backend backends[] = {MP_MUL_BACKEND_SSA, MP_MUL_BACKEND_NTT};
+    enum mp_mul_backend prev = mp_get_mul_backend();
+
+    for (mp_size i = 0; i < 2; i++) {
+        mp_set_mul_backend(backends[i]);
+        mp_test_mul_sizes(MP_MUL_FFT_THRESHOLD + 3, MP_MUL_FFT_THRESHOLD + 3);
+        mp_test_mul_sizes(2 * MP_MUL_FFT_THRESHOLD, MP_MUL_FFT_THRESHOLD + 1);
+        mp_test_sqr_size(MP_MUL_FFT_THRESHOLD + 5);
+    }
+
+    mp_set_mul_backend(prev);
+}
+
+// Products by a prepared operand against mp_mul, reusing one handle for a
+// run of operands shorter and longer than it. Below
+// MP_MUL_PREPARED_THRESHOLD the handle keeps no transform.
+
+static void mp_test_prepared_size(mp_size bn)
+{
+    mp_size t = MP_MUL_PREPARED_THRESHOLD;
+    mp_size sizes[] = {1, 7, bn - 1, bn, bn + 1, t - 1, t, t + 2, 2 * bn + 5};
+    mp_uint *bp = mp_test_alloc(bn);
+    struct mp_mul_prepared prep;
+
+    mp_test_fill_top(bp, bn);
+    MP_CHECK(!mp_mul_prepare(&prep, bp, bn, NULL));
+    MP_CHECK(!prep._data == (bn < t));
+
+    for (mp_size i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        mp_size an = sizes[i];
+
+        if (!an) {
+            continue;
+        }
+
+        mp_uint *ap = mp_test_alloc(an);
+        mp_uint *rp = mp_test_alloc(an + bn);
+        mp_uint *ep = mp_test_alloc(an + bn);
+
+        mp_test_fill_top(ap, an);
+
+        if (an >= bn) {
+            mp_mul(ap, an, bp, bn, ep);
+        } else {
+            mp_mul(bp, bn, ap, an, ep);
+        }
+
+        MP_CHECK(mp_mul_prepared(ap, an, &prep, rp) == ep[an + bn - 1]);
+        MP_CHECK(mp_test_equal(rp, ep, an + bn));
+
+        free(ap);
+        free(rp);
+        free(ep);
+    }
+
+    mp_mul_prepared_destruct(&prep);
+    free(bp);
+}
+
+static void mp_test_prepared(void)
+{
+    mp_size t = MP_MUL_PREPARED_THRESHOLD;
+
+    mp_test_prepared_size(1);
+    mp_test_prepared_size(40);
+    mp_test_prepared_size(t - 1);
+    mp_test_prepared_size(t);
+    mp_test_prepared_size(t + 300);
+}
+
+// The short products against the halves of the schoolbook product, through
+// the basecase, the recursion and the full product above the FFT threshold.
+// mulhi may fall short of the high half by at most 3n.
+
+static void mp_test_short_size(mp_size n, mp_bool ones)
+{
+    mp_uint *ap = mp_test_alloc(n);
+    mp_uint *bp = mp_test_alloc(n);
+    mp_uint *rp = mp_test_alloc(n);
+    mp_uint *ep = mp_test_alloc(2 * n);
+
+    if (ones) {
+        memset(ap, 0xff, n * sizeof(mp_uint));
+        memset(bp, 0xff, n * sizeof(mp_uint));
+    } else {
+        mp_test_fill(ap, n);
+        mp_test_fill(bp, n);
+    }
+
+    mp_test_mul(ap, n, bp, n, ep);
+
+    mp_mullo_n(ap, bp, n, rp);
+    MP_CHECK(mp_test_equal(rp, ep, n));
+
+    mp_mulhi_n(ap, bp, n, rp);
+    MP_CHECK(!mp_sub_n(ep + n, rp, n, rp));
+
+    for (mp_size i = 1; i < n; i++) {
+        MP_CHECK(!rp[i]);
+    }
+
+    MP_CHECK(rp[0] <= 3 * n);
+
+    free(ap);
+    free(bp);
+    free(rp);
+    free(ep);
+}
+
+static void mp_test_short(void)
+{
+    mp_size sizes[] = {
+        1,
+        2,
+        5,
+        MP_MULLO_THRESHOLD - 1,
+        MP_MULLO_THRESHOLD,
+        MP_MULLO_THRESHOLD + 1,
+        MP_MULHI_THRESHOLD - 1,
+        MP_MULHI_THRESHOLD,
+        MP_MULHI_THRESHOLD + 1,
+        3 * MP_MULLO_THRESHOLD + 2,
+        500,
+        MP_MUL_FFT_THRESHOLD - 1,
+        MP_MUL_FFT_THRESHOLD,
+    };
+
+    for (mp_size i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        mp_test_short_size(sizes[i], mp_false);
+        mp_test_short_size(sizes[i], mp_true);
+    }
+}
+
+// The middle product summed a term at a time in double limbs
+
+static void mp_test_mulmid_ref(const mp_uint *ap, mp_size an,
+                               const mp_uint *bp, mp_size bn, mp_uint *rp)
+{
+    mp_size rn = an - bn + 3;
+
+    memset(rp, 0, rn * sizeof(mp_uint));
+
+    for (mp_size j = 0; j < bn; j++) {
+        for (mp_size i = bn - 1 - j; i + j < an; i++) {
+            mp_test_uint2 t = (mp_test_uint2)ap[i] * bp[j];
+
+            for (mp_size k = i + j - bn + 1; t; k++) {
+                t += rp[k];
+                rp[k] = (mp_uint)t;
+                t >>= 64;
+            }
+        }
+    }
+}
+
+static void mp_test_mulmid_sizes(mp_size an, mp_size bn)
+{
+    mp_size rn = an - bn + 3;
+    mp_uint *ap = mp_test_alloc(an);
+    mp_uint *bp = mp_test_alloc(bn);
+    mp_uint *rp = mp_test_alloc(rn);
+    mp_uint *ep = mp_test_alloc(rn);
+
+    mp_test_fill(ap, an);
+    mp_test_fill(bp, bn);
+    mp_test_mulmid_ref(ap, an, bp, bn, ep);
+
+    mp_mulmid(ap, an, bp, bn, rp);
+    MP_CHECK(mp_test_equal(rp, ep, rn));
+
+    memset(ap, 0xff, an * sizeof(mp_uint));
+    memset(bp, 0xff, bn * sizeof(mp_uint));
+    mp_test_mulmid_ref(ap, an, bp, bn, ep);
+
+    mp_mulmid(ap, an, bp, bn, rp);
+    MP_CHECK(mp_test_equal(rp, ep, rn));
+
+    free(ap);
+    free(bp);
+    free(rp);
+    free(ep);
+}
+
+// Both when the result is longer than b and when it is shorter, with the odd
+// rows and columns the recursion peels off, and above the NTT threshold
+
+static void mp_test_mulmid(void)
+{
+    mp_size t = MP_MULMID_THRESHOLD;
+    mp_size nt = MP_MULMID_NTT_THRESHOLD;
+
+    mp_test_mulmid_sizes(1, 1);
+    mp_test_mulmid_sizes(5, 5);
+    mp_test_mulmid_sizes(10, 4);
+    mp_test_mulmid_sizes(3 * t, t - 1);
+    mp_test_mulmid_sizes(2 * t - 1, t);
+    mp_test_mulmid_sizes(2 * t, t);
+    mp_test_mulmid_sizes(5 * t + 3, t + 1);
+    mp_test_mulmid_sizes(7 * t + 1, 2 * t);
+    mp_test_mulmid_sizes(4 * t - 3, 3 * t);
+    mp_test_mulmid_sizes(4 * t, 3 * t);
+    mp_test_mulmid_sizes(10 * t, 6 * t + 1);
+    mp_test_mulmid_sizes(2 * nt + 1, nt);
+    mp_test_mulmid_sizes(3 * nt, 2 * nt - 5);
+}
+
+// mp_sub_n once dropped the borrow between limbs
+
+static void mp_test_sub_borrow(void)
+{
+    mp_uint a[] = {0, 0, 0, 1};
+    mp_uint b[] = {1, 0, 0, 0};
+    mp_uint r[4];
+    mp_uint e[] = {~(mp_uint)0, ~(mp_uint)0, ~(mp_uint)0, 0};
+
+    MP_CHECK(!mp_sub_n(a, b, 4, r));
+    MP_CHECK(mp_test_equal(r, e, 4));
+    MP_CHECK(mp_sub_n(b, a, 4, r) == 1);
+    MP_CHECK(r[0] == 1 && r[1] == 0 && r[2] == 0 && r[3] == ~(mp_uint)0);
+}
+
+// The shifts once lost the limbs next to the ends
+
+static void mp_test_shifts(void)
+{
+    for (mp_size n = 1; n <= 20; n++) {
+        for (mp_size bits = 1; bits < MP_UINT_WIDTH; bits += 7) {
+            mp_uint ap[20], rp[20], ep[20];
+            mp_size rbits = MP_UINT_WIDTH - bits;
+
+            mp_test_fill(ap, n);
+
+            for (mp_size i = 0; i < n; i++) {
+                ep[i] = ap[i] << bits | (i ? ap[i - 1] >> rbits : 0);
+            }
+
+            MP_CHECK(mp_left_shift(ap, n, bits, rp) == ap[n - 1] >> rbits);
+            MP_CHECK(mp_test_equal(rp, ep, n));
+
+            for (mp_size i = 0; i < n; i++) {
+                ep[i] = ap[i] >> bits | (i + 1 < n ? ap[i + 1] << rbits : 0);
+            }
+
+            MP_CHECK(mp_right_shift(ap, n, bits, rp) == ap[0] << rbits);
+            MP_CHECK(mp_test_equal(rp, ep, n));
+
+            // in place
+            memcpy(rp, ap, n * sizeof(mp_uint));
+            MP_CHECK(mp_right_shift(rp, n, bits, rp) == ap[0] << rbits);
+            MP_CHECK(mp_test_equal(rp, ep, n));
+        }
+    }
+}
+
+// Products of more than one limb once came out with the wrong size, and
+// copies of them with no limbs copied. a^4 is formed three ways here.
+
+static void mp_test_bigint_mul(void)
+{
+    struct mp_bigint a, b, c, d, e;
+
+    MP_CHECK(!mp_bigint_construct_uint(&a, ~(mp_uint)0, NULL));
+    mp_bigint_construct(&b, NULL);
+    mp_bigint_construct(&d, NULL);
+    mp_bigint_construct(&e, NULL);
+
+    MP_CHECK(!mp_bigint_mul(&a, &a, &b));
+    MP_CHECK(mp_bigint_cmp(&b, &a) > 0);
+    MP_CHECK(!mp_bigint_construct_copy(&c, &b, NULL));
+    MP_CHECK(mp_bigint_equal(&c, &b));
+
+    MP_CHECK(!mp_bigint_mul(&b, &a, &c));
+    MP_CHECK(mp_bigint_cmp(&c, &b) > 0);
+    MP_CHECK(!mp_bigint_mul(&c, &a, &d));
+    MP_CHECK(!mp_bigint_mul(&a, &c, &e));
+    MP_CHECK(mp_bigint_equal(&d, &e));
+    MP_CHECK(!mp_bigint_mul(&b, &b, &e));
+    MP_CHECK(mp_bigint_equal(&d, &e));
+
+    mp_bigint_destruct(&a);
+    mp_bigint_destruct(&b);
+    mp_bigint_destruct(&c);
+    mp_bigint_destruct(&d);
+    mp_bigint_destruct(&e);
+}
+
+int main(void)
+{
+    mp_test_mul_tiers();
+    mp_test_mul_fft();
+    mp_test_prepared();
+    mp_test_short();
+    mp_test_mulmid();
+    mp_test_sub_borrow();
+    mp_test_shifts();
+    mp_test_bigint_mul();
+    return EXIT_SUCCESS;
+}
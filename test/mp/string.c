@@ -0,0 +1,208 @@
+#include <mp/mp.h>
+#include "./test.h"
+
+// Output in every base against digits formed by schoolbook division, and
+// parsed back. Sizes cover the divide and conquer thresholds of both
+// directions, which for parsing is in chunks of a limb of digits.
+
+static const mp_size mp_test_sizes[] = {
+    1,   2,   3,   MP_TO_STRING_DC_THRESHOLD - 1, MP_TO_STRING_DC_THRESHOLD,
+    MP_TO_STRING_DC_THRESHOLD + 1,   2 * MP_TO_STRING_DC_THRESHOLD + 3,
+    100, 127, 128, 129, 257, 600, 1000, 2000,
+};
+
+static const char mp_test_chars[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+// The digits of a, by dividing it by the largest power of the base in a limb
+// in double limbs, independent of the library. s takes an MP_UINT_WIDTH + 1
+// characters, and the count is returned.
+
+static mp_size mp_test_digits(
+    const mp_uint *ap, mp_size an, int base, char *s)
+{
+    mp_uint *tp = mp_test_alloc(an);
+    mp_uint big = base;
+    mp_size k = 1;
+    mp_size count = 0;
+
+    while (big <= MP_UINT_MAX / base) {
+        big *= base;
+        k++;
+    }
+
+    memcpy(tp, ap, an * sizeof(mp_uint));
+
+    while (an && !tp[an - 1]) {
+        an--;
+    }
+
+    while (an) {
+        mp_uint r = 0;
+
+        for (mp_size i = an; i--;) {
+            mp_test_uint2 t = (mp_test_uint2)r << MP_UINT_WIDTH | tp[i];
+
+            tp[i] = (mp_uint)(t / big);
+            r = (mp_uint)(t % big);
+        }
+
+        if (!tp[an - 1]) {
+            an--;
+        }
+
+        for (mp_size i = 0; i < k && (an || r); i++) {
+            s[count++] = mp_test_chars[r % base];
+            r /= base;
+        }
+    }
+
+    if (!count) {
+        s[count++] = '0';
+    }
+
+    for (mp_size i = 0; i < count / 2; i++) {
+        char c = s[i];
+
+        s[i] = s[count - 1 - i];
+        s[count - 1 - i] = c;
+    }
+
+    free(tp);
+    return count;
+}
+
+static void mp_test_string_value(const mp_uint *ap, mp_size an, int base)
+{
+    mp_size cap = an * MP_UINT_WIDTH + 1;
+    char *s = malloc(cap);
+    char *e = malloc(cap);
+    mp_uint *rp = mp_test_alloc(an + 1);
+    mp_size size = an;
+
+    MP_CHECK(s && e);
+
+    while (size && !ap[size - 1]) {
+        size--;
+    }
+
+    mp_size count = mp_test_digits(ap, an, base, e);
+    struct mp_to_string_result out = mp_to_string(s, s + cap, ap, an, base);
+
+    MP_CHECK(out.ec == MP_ERRC_OK);
+    MP_CHECK(out.ptr - s == count && !memcmp(s, e, count));
+
+    // the exact fit, and one character short
+    out = mp_to_string(s, s + count, ap, an, base);
+    MP_CHECK(out.ec == MP_ERRC_OK && out.ptr == s + count);
+    out = mp_to_string(s, s + count - 1, ap, an, base);
+    MP_CHECK(out.ec == MP_ERRC_NOT_ENOUGH_MEMORY);
+
+    struct mp_from_string_result in = mp_from_string(e, e + count, rp, an,
+                                                     base);
+
+    MP_CHECK(in.ec == MP_ERRC_OK && in.ptr == e + count);
+    MP_CHECK(in.size == size && mp_test_equal(rp, ap, size));
+
+    if (size > 1) {
+        in = mp_from_string(e, e + count, rp, size - 1, base);
+        MP_CHECK(in.ec == MP_ERRC_VALUE_TOO_LARGE && in.size == size);
+    }
+
+    free(s);
+    free(e);
+    free(rp);
+}
+
+static void mp_test_string_sizes(int base, mp_size max)
+{
+    mp_size count = sizeof(mp_test_sizes) / sizeof(mp_test_sizes[0]);
+
+    for (mp_size i = 0; i < count && mp_test_sizes[i] <= max; i++) {
+        mp_size n = mp_test_sizes[i];
+        mp_uint *ap = mp_test_alloc(n);
+
+        mp_test_fill_top(ap, n);
+        mp_test_string_value(ap, n, base);
+
+        // all one limbs, the most digits for the size
+        memset(ap, 0xff, n * sizeof(mp_uint));
+        mp_test_string_value(ap, n, base);
+
+        free(ap);
+    }
+}
+
+// Zero limbs above the value, and single limbs at the edges of the digits
+
+static void mp_test_string_edges(int base)
+{
+    mp_uint ap[8];
+    mp_uint big = base;
+
+    while (big <= MP_UINT_MAX / base) {
+        big *= base;
+    }
+
+    mp_uint values[] = {
+        1, base - 1, base, base + 1, big - 1, big, big + 1, MP_UINT_MAX,
+    };
+
+    for (mp_size i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        ap[0] = values[i];
+        mp_test_string_value(ap, 1, base);
+    }
+
+    memset(ap, 0, sizeof(ap));
+    mp_test_string_value(ap, 3, base);
+
+    for (mp_size n = 1; n <= 5; n++) {
+        mp_test_fill_top(ap, n);
+        mp_test_string_value(ap, 8, base);
+    }
+}
+
+static void mp_test_string_known(
+    const mp_uint *ap, mp_size an, const char *s)
+{
+    char buf[64];
+    mp_uint rp[2];
+    mp_size count = strlen(s);
+    struct mp_to_string_result out = mp_to_string(buf, buf + sizeof(buf), ap,
+                                                  an, 10);
+    struct mp_from_string_result in = mp_from_string(s, s + count, rp, 2, 10);
+
+    MP_CHECK(out.ec == MP_ERRC_OK);
+    MP_CHECK(out.ptr - buf == count && !memcmp(buf, s, count));
+    MP_CHECK(in.ec == MP_ERRC_OK && in.ptr == s + count);
+    MP_CHECK(in.size == an && mp_test_equal(rp, ap, an));
+}
+
+static void mp_test_string_knowns(void)
+{
+    mp_uint max = MP_UINT_MAX;
+    mp_uint e19 = 10000000000000000000u;
+    mp_uint e19m1 = e19 - 1;
+    mp_uint e19p1 = e19 + 1;
+
+    mp_test_string_known(NULL, 0, "0");
+    mp_test_string_known(&max, 1, "18446744073709551615");
+    mp_test_string_known(&e19m1, 1, "9999999999999999999");
+    mp_test_string_known(&e19, 1, "10000000000000000000");
+    mp_test_string_known(&e19p1, 1, "10000000000000000001");
+}
+
+int main(void)
+{
+    mp_test_string_knowns();
+
+    // the other bases are written a limb of digits per pass, which is
+    // quadratic, so they stop short of the largest sizes
+    for (int base = 2; base <= 36; base++) {
+        mp_bool fast = base == 10 || !(base & (base - 1));
+
+        mp_test_string_edges(base);
+        mp_test_string_sizes(base, fast ? 2000 : 300);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+#ifndef MP_TEST_H_
+#define MP_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mp/bigint.h>
+#include <mp/mp.h>
+
+// Helpers shared by the tests. Each test is its own program, which reports
+// the first failed check and exits with a nonzero status.
+
+#define MP_CHECK(x)                                                            \
+    do {                                                                       \
+        if (!(x)) {                                                            \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,  \
+                    #x);                                                       \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+typedef unsigned __int128 mp_test_uint2;
+
+static uint64_t mp_test_state = 0x9e3779b97f4a7c15;
+
+static inline mp_uint mp_test_rand(void)
+{
+    uint64_t x = mp_test_state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return mp_test_state = x;
+}
+
+// Random limbs, with runs of zero and all one limbs, which are where the
+// carries and borrows go wrong
+
+static inline void mp_test_fill(mp_uint *p, mp_size n)
+{
+    for (mp_size i = 0; i < n; i++) {
+        switch (mp_test_rand() % 8) {
+        case 0:
+            p[i] = 0;
+            break;
+        case 1:
+            p[i] = ~(mp_uint)0;
+            break;
+        default:
+            p[i] = mp_test_rand();
+        }
+    }
+}
+
+// Random limbs with a nonzero top limb
+
+static inline void mp_test_fill_top(mp_uint *p, mp_size n)
+{
+    mp_uint top = 0;
+
+    while (!top) {
+        top = mp_test_rand() >> (mp_test_rand() % 64);
+    }
+
+    mp_test_fill(p, n - 1);
+    p[n - 1] = top;
+}
+
+static inline mp_uint *mp_test_alloc(mp_size n)
+{
+    mp_uint *p = malloc((n ? n : 1) * sizeof(mp_uint));
+
+    MP_CHECK(p);
+    return p;
+}
+
+// The schoolbook product, a row at a time in double limbs, independent of
+// the library
+
+static inline void mp_test_mul(const mp_uint *ap, mp_size an,
+                               const mp_uint *bp, mp_size bn, mp_uint *rp)
+{
+    memset(rp, 0, (an + bn) * sizeof(mp_uint));
+
+    for (mp_size j = 0; j < bn; j++) {
+        mp_uint c = 0;
+
+        for (mp_size i = 0; i < an; i++) {
+            mp_test_uint2 t = (mp_test_uint2)ap[i] * bp[j] + rp[i + j] + c;
+
+            rp[i + j] = (mp_uint)t;
+            c = (mp_uint)(t >> 64);
+        }
+
+        rp[an + j] = c;
+    }
+}
+
+static inline mp_bool mp_test_equal(
+    const mp_uint *ap, const mp_uint *bp, mp_size n)
+{
+    return !n || !memcmp(ap, bp, n * sizeof(mp_uint));
+}
+
+// A random value of n limbs, as a product of random limbs, negative if neg
+
+static inline void mp_test_bigint_rand(
+    struct mp_bigint *x, mp_size n, mp_bool neg)
+{
+    struct mp_bigint y;
+
+    MP_CHECK(!mp_bigint_assign_uint(x, 1));
+    mp_bigint_construct(&y, NULL);
+
+    for (mp_size i = 0; i < n; i++) {
+        mp_uint limb = 0;
+
+        while (!limb) {
+            limb = mp_test_rand();
+        }
+
+        MP_CHECK(!mp_bigint_assign_uint(&y, limb));
+        MP_CHECK(!mp_bigint_mul(x, &y, x));
+    }
+
+    if (neg) {
+        mp_bigint_negate(x);
+    }
+
+    mp_bigint_destruct(&y);
+}
+
+// e = a + b, passing only nonzero operands to mp_bigint_add
+
+static inline void mp_test_bigint_add(
+    const struct mp_bigint *a, const struct mp_bigint *b, struct mp_bigint *e)
+{
+    if (!mp_bigint_sign(a)) {
+        MP_CHECK(!mp_bigint_assign_copy(e, b));
+    } else if (!mp_bigint_sign(b)) {
+        MP_CHECK(!mp_bigint_assign_copy(e, a));
+    } else {
+        MP_CHECK(!mp_bigint_add(a, b, e));
+    }
+}
+
+#endif